@@ -0,0 +1,425 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "handle_pool/handle_pool.h"
+#include "rwlock/rw_lock.h"
+#include "rwlock/shared_lock.h"
+#include "rwlock/unique_lock.h"
+
+namespace handle_pool {
+
+namespace internal {
+
+// Position of C in the pack Ts... (compile error if C is not in the pack).
+template <typename C, typename... Ts> struct TypeIndex;
+
+template <typename C, typename... Ts>
+struct TypeIndex<C, C, Ts...> : std::integral_constant<size_t, 0> {};
+
+template <typename C, typename U, typename... Ts>
+struct TypeIndex<C, U, Ts...>
+    : std::integral_constant<size_t, 1 + TypeIndex<C, Ts...>::value> {};
+
+} // namespace internal
+
+/*
+ * An entity store that groups entities by their component set ("archetype").
+ *
+ * `Components...` is the closed set of component types the store knows
+ * about. Every entity with the same subset of components lives in the same
+ * archetype table, which keeps one contiguous column per component (SoA)
+ * plus the owning entity of each row. A stable `Handle` maps through the
+ * entity table to (archetype, row); adding or removing a component moves the
+ * entity's row into the matching table.
+ *
+ * `ForEach<Cs...>(fn)` visits every entity that has at least the components
+ * `Cs...` by scanning the columns of each matching archetype linearly.
+ *
+ * References returned by `Get` and passed to `ForEach` are only valid until
+ * the next `Create`, `Destroy`, `Add` or `Remove`, since those may move rows.
+ *
+ * Components must be nothrow move-assignable, since erasing a row fills the
+ * hole with the last row. If appending a row throws (a component's copy or
+ * move, or an allocation), `Create`, `Add` and `Remove` undo what they
+ * appended and report failure, leaving the entity as it was.
+ *
+ * Thread-safety:
+ * - `Create`, `Destroy`, `Add` and `Remove` use an exclusive lock.
+ * - `Get`, `Has`, `IsValid` and `ForEach` use a shared lock. `fn` must not
+ * call back into the store.
+ */
+template <typename... Components> class ArchetypeStore {
+  static_assert(sizeof...(Components) <= 64,
+                "ArchetypeStore supports at most 64 component types");
+  static_assert((std::is_nothrow_move_assignable_v<Components> && ...),
+                "ArchetypeStore fills erased rows by move assignment; it "
+                "must not throw");
+
+public:
+  using Mask = uint64_t;
+
+  explicit ArchetypeStore(const size_t capacity) : capacity_(capacity) {
+    assert(capacity_ > 0);
+    entities_.resize(capacity_);
+    free_list_.reserve(capacity_);
+    for (uint32_t i = 0; i < capacity_; ++i) {
+      free_list_.push_back(i);
+    }
+  }
+
+  // Creates an entity holding the given components, returning a handle.
+  // Returns Handle::Invalid() if the store is full or a component throws.
+  template <typename... Cs> const Handle Create(Cs &&...components) {
+    constexpr Mask mask = MaskOf<std::decay_t<Cs>...>();
+    static_assert(PopCount(mask) == sizeof...(Cs),
+                  "Create() takes each component type at most once");
+
+    rwlock::UniqueLock l(rwlock_);
+
+    if (free_list_.empty()) {
+      return Handle::Invalid();
+    }
+    const uint32_t index = free_list_.back();
+    Archetype *archetype = nullptr;
+    try {
+      archetype = &FindOrCreateArchetype(mask);
+      (Column<std::decay_t<Cs>>(*archetype).push_back(
+           std::forward<Cs>(components)),
+       ...);
+      archetype->entities.push_back(index);
+    } catch (...) {
+      // Drop the partial row; the slot is only taken once the row is in.
+      if (archetype != nullptr) {
+        TruncateColumns(*archetype);
+      }
+      return Handle::Invalid();
+    }
+    free_list_.pop_back();
+
+    Entity &entity = entities_[index];
+    entity.archetype = archetype->id;
+    entity.row = static_cast<uint32_t>(archetype->entities.size() - 1);
+    entity.in_use = true;
+    return Handle{index, entity.generation};
+  }
+
+  // Destroys the entity and all of its components.
+  bool Destroy(const Handle &handle) {
+    rwlock::UniqueLock l(rwlock_);
+
+    if (!IsValidInternal(handle)) {
+      return false;
+    }
+    Entity &entity = entities_[handle.index];
+    EraseRow(*archetypes_[entity.archetype], entity.row);
+    entity.in_use = false;
+    ++entity.generation;
+    free_list_.push_back(handle.index);
+    return true;
+  }
+
+  // Adds component C to the entity, moving it to the archetype with C.
+  // Returns false if the handle is stale, the entity already has C or
+  // moving the row throws (the entity is then left as it was).
+  template <typename C> bool Add(const Handle &handle, C &&component) {
+    using Component = std::decay_t<C>;
+    rwlock::UniqueLock l(rwlock_);
+
+    if (!IsValidInternal(handle)) {
+      return false;
+    }
+    Entity &entity = entities_[handle.index];
+    const Mask src_mask = archetypes_[entity.archetype]->mask;
+    if (src_mask & Bit<Component>()) {
+      return false;
+    }
+    Archetype *dst = nullptr;
+    try {
+      dst = &FindOrCreateArchetype(src_mask | Bit<Component>());
+      Column<Component>(*dst).push_back(std::forward<C>(component));
+    } catch (...) {
+      if (dst != nullptr) {
+        TruncateColumns(*dst);
+      }
+      return false;
+    }
+    return MoveRow(*archetypes_[entity.archetype], entity.row, *dst);
+  }
+
+  // Removes component C from the entity, moving it to the archetype without
+  // C. Returns false if the handle is stale, the entity does not have C or
+  // moving the row throws (the entity is then left as it was).
+  template <typename C> bool Remove(const Handle &handle) {
+    rwlock::UniqueLock l(rwlock_);
+
+    if (!IsValidInternal(handle)) {
+      return false;
+    }
+    Entity &entity = entities_[handle.index];
+    const Mask src_mask = archetypes_[entity.archetype]->mask;
+    if (!(src_mask & Bit<C>())) {
+      return false;
+    }
+    Archetype *dst = nullptr;
+    try {
+      dst = &FindOrCreateArchetype(src_mask & ~Bit<C>());
+    } catch (...) {
+      return false;
+    }
+    return MoveRow(*archetypes_[entity.archetype], entity.row, *dst);
+  }
+
+  // Returns an optional reference to the entity's C, or nullopt if the handle
+  // is stale or the entity does not have C.
+  template <typename C>
+  std::optional<std::reference_wrapper<C>> Get(const Handle &handle) {
+    rwlock::SharedLock l(rwlock_);
+
+    if (!IsValidInternal(handle)) {
+      return std::nullopt;
+    }
+    const Entity &entity = entities_[handle.index];
+    Archetype &archetype = *archetypes_[entity.archetype];
+    if (!(archetype.mask & Bit<C>())) {
+      return std::nullopt;
+    }
+    return std::ref(Column<C>(archetype)[entity.row]);
+  }
+
+  // Returns true if the handle is valid and the entity has component C.
+  template <typename C> bool Has(const Handle &handle) {
+    rwlock::SharedLock l(rwlock_);
+
+    if (!IsValidInternal(handle)) {
+      return false;
+    }
+    return archetypes_[entities_[handle.index].archetype]->mask & Bit<C>();
+  }
+
+  // Calls fn(Cs &...) for every entity that has all of the components Cs.
+  template <typename... Cs, typename Fn> void ForEach(Fn &&fn) {
+    constexpr Mask required = MaskOf<Cs...>();
+    rwlock::SharedLock l(rwlock_);
+
+    for (auto &archetype : archetypes_) {
+      if ((archetype->mask & required) != required) {
+        continue;
+      }
+      const size_t rows = archetype->entities.size();
+      auto columns = std::make_tuple(Column<Cs>(*archetype).data()...);
+      for (size_t row = 0; row < rows; ++row) {
+        fn(std::get<Cs *>(columns)[row]...);
+      }
+    }
+  }
+
+  // Checks if a given handle is still valid.
+  bool IsValid(const Handle &handle) {
+    rwlock::SharedLock l(rwlock_);
+    return IsValidInternal(handle);
+  }
+
+  inline constexpr size_t Capacity() const { return capacity_; }
+
+  // Returns true if there are no live entities.
+  bool Empty() {
+    rwlock::SharedLock l(rwlock_);
+    return (free_list_.size() == capacity_);
+  }
+
+  // Returns how many free entity slots remain.
+  size_t Free() {
+    rwlock::SharedLock l(rwlock_);
+    return free_list_.size();
+  }
+
+  // Returns how many distinct component sets have been seen so far.
+  size_t ArchetypeCount() {
+    rwlock::SharedLock l(rwlock_);
+    return archetypes_.size();
+  }
+
+  // Disallow copy (owning resource).
+  ArchetypeStore(const ArchetypeStore &) = delete;
+  ArchetypeStore &operator=(const ArchetypeStore &) = delete;
+
+private:
+  struct Entity {
+    uint32_t generation = 0;
+    uint32_t archetype = 0;
+    uint32_t row = 0;
+    bool in_use = false;
+  };
+
+  struct Archetype {
+    uint32_t id;
+    Mask mask;
+    // Row -> owning entity index.
+    std::vector<uint32_t> entities;
+    // One column per component type; only those in `mask` are populated.
+    std::tuple<std::vector<Components>...> columns;
+  };
+
+  template <size_t I>
+  using ComponentAt = std::tuple_element_t<I, std::tuple<Components...>>;
+
+  template <typename C> static constexpr Mask Bit() {
+    return Mask{1} << internal::TypeIndex<C, Components...>::value;
+  }
+
+  template <typename... Cs> static constexpr Mask MaskOf() {
+    return (Mask{0} | ... | Bit<Cs>());
+  }
+
+  static constexpr size_t PopCount(Mask mask) {
+    size_t count = 0;
+    for (; mask != 0; mask &= mask - 1) {
+      ++count;
+    }
+    return count;
+  }
+
+  template <typename C> static std::vector<C> &Column(Archetype &archetype) {
+    return std::get<internal::TypeIndex<C, Components...>::value>(
+        archetype.columns);
+  }
+
+  // Calls fn(std::integral_constant<size_t, I>) for every component I in mask.
+  template <typename Fn>
+  static void ForEachComponent(const Mask mask, Fn &&fn) {
+    ForEachComponentImpl(mask, fn, std::index_sequence_for<Components...>{});
+  }
+
+  template <typename Fn, size_t... I>
+  static void ForEachComponentImpl(const Mask mask, Fn &fn,
+                                   std::index_sequence<I...>) {
+    ((((mask >> I) & 1) ? fn(std::integral_constant<size_t, I>{}) : void()),
+     ...);
+  }
+
+  // Leaves the store unchanged if it throws.
+  Archetype &FindOrCreateArchetype(const Mask mask) {
+    auto it = archetype_index_.find(mask);
+    if (it != archetype_index_.end()) {
+      return *archetypes_[it->second];
+    }
+    const uint32_t id = static_cast<uint32_t>(archetypes_.size());
+    auto archetype = std::make_unique<Archetype>();
+    archetype->id = id;
+    archetype->mask = mask;
+    archetypes_.reserve(archetypes_.size() + 1);
+    archetype_index_.emplace(mask, id);
+    archetypes_.push_back(std::move(archetype));
+    return *archetypes_.back();
+  }
+
+  // Removes `row` from `archetype` by moving its last row into the hole.
+  void EraseRow(Archetype &archetype, const uint32_t row) {
+    const uint32_t last = static_cast<uint32_t>(archetype.entities.size() - 1);
+    ForEachComponent(archetype.mask, [&](auto index) {
+      auto &column = std::get<decltype(index)::value>(archetype.columns);
+      if (row != last) {
+        column[row] = std::move(column[last]);
+      }
+      column.pop_back();
+    });
+    if (row != last) {
+      archetype.entities[row] = archetype.entities[last];
+      entities_[archetype.entities[row]].row = row;
+    }
+    archetype.entities.pop_back();
+  }
+
+  // Moves the components `src` and `dst` have in common from `row` of `src`
+  // to the end of `dst` and repoints the owning entity. Components that only
+  // `dst` has must already have been appended by the caller. If an
+  // allocation or a component copy throws, drops the partial row from `dst`
+  // and returns false with `src` intact.
+  bool MoveRow(Archetype &src, const uint32_t row, Archetype &dst) {
+    const Mask shared = src.mask & dst.mask;
+    const uint32_t entity_index = src.entities[row];
+    try {
+      // Make room first, so that no append below reallocates.
+      ReserveOneMore(dst.entities);
+      ForEachComponent(shared, [&](auto index) {
+        ReserveOneMore(std::get<decltype(index)::value>(dst.columns));
+      });
+      // Copy the components whose move may throw while `src` is intact.
+      ForEachComponent(shared, [&](auto index) {
+        constexpr size_t I = decltype(index)::value;
+        if constexpr (!std::is_nothrow_move_constructible_v<ComponentAt<I>>) {
+          std::get<I>(dst.columns).push_back(
+              std::move_if_noexcept(std::get<I>(src.columns)[row]));
+        }
+      });
+    } catch (...) {
+      TruncateColumns(dst);
+      return false;
+    }
+    // Nothing below can throw.
+    ForEachComponent(shared, [&](auto index) {
+      constexpr size_t I = decltype(index)::value;
+      if constexpr (std::is_nothrow_move_constructible_v<ComponentAt<I>>) {
+        std::get<I>(dst.columns).push_back(
+            std::move(std::get<I>(src.columns)[row]));
+      }
+    });
+    dst.entities.push_back(entity_index);
+    EraseRow(src, row);
+
+    Entity &entity = entities_[entity_index];
+    entity.archetype = dst.id;
+    entity.row = static_cast<uint32_t>(dst.entities.size() - 1);
+    return true;
+  }
+
+  // Makes room for one more element, growing geometrically.
+  template <typename T> static void ReserveOneMore(std::vector<T> &vector) {
+    if (vector.size() == vector.capacity()) {
+      vector.reserve(vector.empty() ? 1 : 2 * vector.size());
+    }
+  }
+
+  // Drops column entries past the archetype's last row, undoing a partly
+  // appended row.
+  void TruncateColumns(Archetype &archetype) {
+    const size_t rows = archetype.entities.size();
+    ForEachComponent(archetype.mask, [&](auto index) {
+      auto &column = std::get<decltype(index)::value>(archetype.columns);
+      while (column.size() > rows) {
+        column.pop_back();
+      }
+    });
+  }
+
+  // Checks validity without locking (callers must hold a lock).
+  bool IsValidInternal(const Handle &handle) const {
+    if (handle.index >= capacity_ || handle == Handle::Invalid()) {
+      return false;
+    }
+    const Entity &entity = entities_[handle.index];
+    return entity.in_use && (entity.generation == handle.generation);
+  }
+
+  const size_t capacity_{0};
+
+  std::vector<Entity> entities_;
+  std::vector<uint32_t> free_list_;
+  std::vector<std::unique_ptr<Archetype>> archetypes_;
+  std::unordered_map<Mask, uint32_t> archetype_index_;
+
+  // Protect all shared data (entities_, free_list_ and archetypes_).
+  rwlock::RWLock rwlock_;
+};
+
+} // namespace handle_pool
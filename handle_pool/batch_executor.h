@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "handle_pool/handle_pool.h"
+#include "rwlock/shared_lock.h"
+#include "rwlock/unique_lock.h"
+
+namespace handle_pool {
+
+/*
+ * Runs a batch of Get, Modify and Destroy operations on a HandlePool in
+ * ascending `Handle::index` order, so that a batch of random handles into a
+ * large pool becomes a near-sequential sweep over its slots and storage
+ * instead of a series of TLB and cache misses.
+ *
+ * `Execute` radix-sorts the queued operations by index (stably, so that
+ * operations on the same handle keep their order) before taking the pool's
+ * lock, then runs them all in one locked pass, prefetching the slots and
+ * objects of operations a few steps ahead. Results are returned in the order
+ * the operations were queued.
+ *
+ * The callbacks run under the pool's lock and must not call back into the
+ * pool.
+ *
+ * Thread-safety: an executor is used by one thread at a time; any number of
+ * executors may share a pool.
+ */
+template <typename T> class BatchExecutor {
+public:
+  explicit BatchExecutor(HandlePool<T> &pool) : pool_(pool) {}
+
+  // Queues fn(const T &) on the handle's object.
+  void Get(const Handle &handle, std::function<void(const T &)> fn) {
+    ops_.push_back(Op{handle.Pack(), Kind::kGet, std::move(fn), nullptr});
+  }
+
+  // Queues fn(T &) on the handle's object.
+  void Modify(const Handle &handle, std::function<void(T &)> fn) {
+    ops_.push_back(Op{handle.Pack(), Kind::kModify, nullptr, std::move(fn)});
+  }
+
+  // Queues destruction of the handle's object.
+  void Destroy(const Handle &handle) {
+    ops_.push_back(Op{handle.Pack(), Kind::kDestroy, nullptr, nullptr});
+  }
+
+  // Number of queued operations.
+  size_t Size() const { return ops_.size(); }
+
+  // Runs and clears the queued operations. Element i of the result tells
+  // whether the i-th queued operation found a valid handle.
+  std::vector<bool> Execute() {
+    std::vector<bool> results(ops_.size());
+    const std::vector<uint32_t> order = SortedOrder();
+
+    bool exclusive = false;
+    for (const Op &op : ops_) {
+      exclusive |= op.kind != Kind::kGet;
+    }
+    typename HandlePool<T>::Sizing sizing;
+    if (exclusive) {
+      rwlock::UniqueLock l(pool_.rwlock_);
+      Run(order, results, sizing);
+    } else {
+      rwlock::SharedLock l(pool_.rwlock_);
+      Run(order, results, sizing);
+    }
+    pool_.ApplySizing(sizing);
+    ops_.clear();
+    return results;
+  }
+
+  // Disallow copy (refers to its pool).
+  BatchExecutor(const BatchExecutor &) = delete;
+  BatchExecutor &operator=(const BatchExecutor &) = delete;
+
+private:
+  // Operations this far ahead have their slot prefetched, and half as far
+  // ahead their object.
+  static constexpr size_t kPrefetchDistance = 16;
+
+  enum class Kind : uint8_t { kGet, kModify, kDestroy };
+
+  struct Op {
+    // Packed Handle.
+    uint64_t handle;
+    Kind kind;
+    std::function<void(const T &)> read;
+    std::function<void(T &)> write;
+  };
+
+  static uint32_t IndexOf(const Op &op) {
+    return static_cast<uint32_t>(op.handle);
+  }
+
+  // Queue positions ordered by handle index: an LSD radix sort with 8-bit
+  // digits that skips digits all indices share.
+  std::vector<uint32_t> SortedOrder() const {
+    const size_t n = ops_.size();
+    std::vector<uint32_t> order(n), scratch(n);
+    for (uint32_t i = 0; i < n; ++i) {
+      order[i] = i;
+    }
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+      std::array<size_t, 257> counts{};
+      for (const Op &op : ops_) {
+        ++counts[((IndexOf(op) >> shift) & 0xff) + 1];
+      }
+      if (*std::max_element(counts.begin(), counts.end()) == n) {
+        continue;
+      }
+      for (size_t d = 1; d < counts.size(); ++d) {
+        counts[d] += counts[d - 1];
+      }
+      for (const uint32_t i : order) {
+        scratch[counts[(IndexOf(ops_[i]) >> shift) & 0xff]++] = i;
+      }
+      order.swap(scratch);
+    }
+    return order;
+  }
+
+  // Runs the operations in `order` (pool lock held, exclusive unless all are
+  // Gets).
+  void Run(const std::vector<uint32_t> &order, std::vector<bool> &results,
+           typename HandlePool<T>::Sizing &sizing) {
+    const size_t capacity = pool_.Capacity();
+    for (size_t k = 0; k < order.size(); ++k) {
+      Prefetch(order, k, capacity);
+
+      const Op &op = ops_[order[k]];
+      const Handle handle = Handle::Unpack(op.handle);
+      if (op.kind == Kind::kDestroy) {
+        typename HandlePool<T>::Sizing op_sizing;
+        results[order[k]] = pool_.DestroyInternal(handle, op_sizing);
+        if (op_sizing.grow_chunks > 0 || op_sizing.shrink_bytes > 0) {
+          sizing = op_sizing;
+        }
+        continue;
+      }
+      if (!pool_.IsValidInternal(handle)) {
+        HANDLE_POOL_PROBE3(get_miss, &pool_, handle.index, handle.generation);
+        pool_.Trace(TraceOp::kGetMiss, handle);
+        results[order[k]] = false;
+        continue;
+      }
+      const auto &slot = pool_.slots_[handle.index];
+      const uint32_t position = slot.position;
+      pool_.SampleAccess(slot);
+      pool_.Trace(TraceOp::kGet, handle);
+      if (op.kind == Kind::kModify) {
+        op.write(*reinterpret_cast<T *>(
+            &pool_.MutableItemAt(position).storage));
+      } else {
+        const auto &item = static_cast<const HandlePool<T> &>(pool_).ItemAt(
+            position);
+        op.read(*reinterpret_cast<const T *>(&item.storage));
+      }
+      results[order[k]] = true;
+    }
+  }
+
+  void Prefetch(const std::vector<uint32_t> &order, const size_t k,
+                const size_t capacity) const {
+    if (k + kPrefetchDistance < order.size()) {
+      const uint32_t index = IndexOf(ops_[order[k + kPrefetchDistance]]);
+      if (index < capacity) {
+        __builtin_prefetch(&pool_.slots_[index]);
+      }
+    }
+    if (k + kPrefetchDistance / 2 < order.size()) {
+      const uint32_t index = IndexOf(ops_[order[k + kPrefetchDistance / 2]]);
+      if (index < capacity) {
+        const auto &pool = static_cast<const HandlePool<T> &>(pool_);
+        __builtin_prefetch(&pool.ItemAt(pool.slots_[index].position));
+      }
+    }
+  }
+
+  HandlePool<T> &pool_;
+  std::vector<Op> ops_;
+};
+
+} // namespace handle_pool
@@ -0,0 +1,191 @@
+// Times BFS and PageRank over a HandleGraph that has been churned by
+// removing and re-adding vertices and edges.
+//
+// Usage:
+//   graph_traversal [--vertices=N] [--degree=N] [--churn=F]
+//                   [--pagerank_iterations=N] [--seed=N]
+//
+// The graph starts with `vertices` vertices of `degree` random out-edges
+// each. Then `churn` (a fraction of the vertices) rounds each remove a random
+// vertex, remove a random edge, and add a vertex with `degree` fresh
+// out-edges, leaving dead adjacency entries, moved runs and reused slots
+// behind as a long-running dependency graph would.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "handle_pool/handle_graph.h"
+
+namespace {
+
+struct Config {
+  size_t vertices = 100000;
+  size_t degree = 8;
+  double churn = 0.5;
+  size_t pagerank_iterations = 10;
+  uint64_t seed = 1;
+};
+
+using Graph = handle_pool::HandleGraph<uint32_t, float>;
+
+// Adds a vertex with `degree` edges to random live vertices.
+void AddVertex(const Config &config, Graph &graph,
+               std::vector<uint64_t> &vertices, std::vector<uint64_t> &edges,
+               std::mt19937_64 &rng) {
+  const handle_pool::Handle v =
+      graph.AddVertex(static_cast<uint32_t>(vertices.size()));
+  if (v == handle_pool::Handle::Invalid()) {
+    return;
+  }
+  vertices.push_back(v.Pack());
+  for (size_t i = 0; i < config.degree; ++i) {
+    const uint64_t target = vertices[rng() % vertices.size()];
+    const handle_pool::Handle e =
+        graph.AddEdge(v, handle_pool::Handle::Unpack(target), 1.0f);
+    if (e != handle_pool::Handle::Invalid()) {
+      edges.push_back(e.Pack());
+    }
+  }
+}
+
+// Removes a random element of `handles` (swap with last).
+uint64_t TakeRandom(std::vector<uint64_t> &handles, std::mt19937_64 &rng) {
+  const size_t i = rng() % handles.size();
+  const uint64_t packed = handles[i];
+  handles[i] = handles.back();
+  handles.pop_back();
+  return packed;
+}
+
+bool ParseFlag(const std::string &arg, const std::string &name,
+               std::string *value) {
+  const std::string prefix = "--" + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  *value = arg.substr(prefix.size());
+  return true;
+}
+
+double MillisSince(const std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Config config;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    std::string value;
+    if (ParseFlag(arg, "vertices", &value)) {
+      config.vertices = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (ParseFlag(arg, "degree", &value)) {
+      config.degree = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (ParseFlag(arg, "churn", &value)) {
+      config.churn = std::strtod(value.c_str(), nullptr);
+    } else if (ParseFlag(arg, "pagerank_iterations", &value)) {
+      config.pagerank_iterations = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (ParseFlag(arg, "seed", &value)) {
+      config.seed = std::strtoull(value.c_str(), nullptr, 10);
+    } else {
+      std::cerr << "unknown flag: " << arg << "\n";
+      return 2;
+    }
+  }
+  if (config.vertices == 0) {
+    std::cerr << "--vertices must be positive\n";
+    return 2;
+  }
+
+  std::mt19937_64 rng(config.seed);
+  Graph graph(config.vertices, config.vertices * config.degree);
+  std::vector<uint64_t> vertices, edges;
+  vertices.reserve(config.vertices);
+  edges.reserve(config.vertices * config.degree);
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < config.vertices; ++i) {
+    AddVertex(config, graph, vertices, edges, rng);
+  }
+  const double build_ms = MillisSince(start);
+
+  start = std::chrono::steady_clock::now();
+  const size_t rounds = static_cast<size_t>(config.churn * config.vertices);
+  for (size_t i = 0; i < rounds && vertices.size() > 1; ++i) {
+    graph.RemoveVertex(handle_pool::Handle::Unpack(TakeRandom(vertices, rng)));
+    while (!edges.empty() &&
+           !graph.RemoveEdge(
+               handle_pool::Handle::Unpack(TakeRandom(edges, rng)))) {
+      // Skip edges already gone with their vertex.
+    }
+    AddVertex(config, graph, vertices, edges, rng);
+  }
+  const double churn_ms = MillisSince(start);
+
+  start = std::chrono::steady_clock::now();
+  size_t max_depth = 0;
+  const size_t reached =
+      graph.Bfs(handle_pool::Handle::Unpack(vertices.back()),
+                [&](const handle_pool::Handle &, const size_t depth) {
+                  max_depth = std::max(max_depth, depth);
+                });
+  const double bfs_ms = MillisSince(start);
+
+  // Ranks indexed by vertex index.
+  const float damping = 0.85f;
+  const float base = (1.0f - damping) / vertices.size();
+  std::vector<float> rank(config.vertices, 1.0f / vertices.size());
+  std::vector<float> next(config.vertices);
+  // Targets of the current vertex, so its adjacency is walked once.
+  std::vector<uint32_t> targets;
+  targets.reserve(config.degree);
+  start = std::chrono::steady_clock::now();
+  for (size_t iteration = 0; iteration < config.pagerank_iterations;
+       ++iteration) {
+    std::fill(next.begin(), next.end(), 0.0f);
+    for (const uint64_t packed : vertices) {
+      const handle_pool::Handle v = handle_pool::Handle::Unpack(packed);
+      targets.clear();
+      graph.ForEachOutEdge(
+          v, [&](const handle_pool::Handle &,
+                 const handle_pool::Handle &target) {
+            targets.push_back(target.index);
+          });
+      if (targets.empty()) {
+        continue;
+      }
+      const float share = damping * rank[v.index] / targets.size();
+      for (const uint32_t target : targets) {
+        next[target] += share;
+      }
+    }
+    for (const uint64_t packed : vertices) {
+      const uint32_t index = handle_pool::Handle::Unpack(packed).index;
+      rank[index] = base + next[index];
+    }
+  }
+  const double pagerank_ms = MillisSince(start);
+
+  std::cout << "vertices:            " << graph.VertexCount() << "\n"
+            << "edges:               " << graph.EdgeCount() << "\n"
+            << "build (ms):          " << build_ms << "\n"
+            << "churn (ms):          " << churn_ms << "\n"
+            << "bfs reached:         " << reached << " (depth " << max_depth
+            << ")\n"
+            << "bfs (ms):            " << bfs_ms << "\n"
+            << "pagerank (ms/iter):  "
+            << (config.pagerank_iterations
+                    ? pagerank_ms / config.pagerank_iterations
+                    : 0.0)
+            << "\n";
+  return 0;
+}
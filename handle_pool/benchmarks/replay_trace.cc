@@ -0,0 +1,299 @@
+// Replays an OpTrace file against a HandlePool configuration and reports
+// how long the operations took.
+//
+// Usage:
+//   replay_trace --trace=<file> [--capacity=N] [--max_capacity=N]
+//                [--auto_size] [--object_bytes=16|64|256|1024]
+//                [--timing=asap|timed] [--repeat=N]
+//
+// Each recorded thread's operations are replayed in timestamp order on a
+// thread of their own, all against one pool. `asap` issues them back to
+// back; `timed` waits until each one's original offset from the start of
+// the trace. Handles from the trace are mapped to the handles the replay
+// pool returns, so any capacity or layout can be evaluated. Ordering across
+// threads is not reproduced: a lookup that overtakes the create it depends
+// on counts as unmapped.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "handle_pool/handle_pool.h"
+#include "handle_pool/op_trace.h"
+
+namespace {
+
+struct Config {
+  std::string trace;
+  size_t capacity = 0;
+  size_t max_capacity = 0;
+  bool auto_size = false;
+  size_t object_bytes = 64;
+  bool timed = false;
+  size_t repeat = 1;
+};
+
+struct Result {
+  size_t ops[handle_pool::kTraceOpCount] = {};
+  size_t failed_creates = 0;
+  size_t unmapped = 0;
+  std::chrono::nanoseconds elapsed{0};
+};
+
+template <size_t Bytes> struct Object {
+  std::array<unsigned char, Bytes> bytes{};
+};
+
+// The replay handle of a traced handle, indexed by the traced index. Written
+// before its traced generation is published, so a reader that sees a
+// matching generation also sees the handle.
+struct Mapping {
+  std::atomic<uint32_t> generation{0};
+  std::atomic<bool> live{false};
+  std::atomic<uint64_t> handle{0};
+};
+
+// Records grouped by recorded thread, each group in timestamp order.
+std::vector<std::vector<handle_pool::TraceRecord>>
+SplitByThread(const std::vector<handle_pool::TraceRecord> &records) {
+  std::vector<uint32_t> threads;
+  for (const auto &record : records) {
+    threads.push_back(record.thread);
+  }
+  std::sort(threads.begin(), threads.end());
+  threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+  std::vector<std::vector<handle_pool::TraceRecord>> split(threads.size());
+  for (const auto &record : records) {
+    const size_t t =
+        std::lower_bound(threads.begin(), threads.end(), record.thread) -
+        threads.begin();
+    split[t].push_back(record);
+  }
+  return split;
+}
+
+// Replays one recorded thread's operations.
+template <typename Pool>
+void ReplayThread(const Config &config,
+                  const std::vector<handle_pool::TraceRecord> &records,
+                  const std::chrono::steady_clock::time_point start,
+                  Pool &pool, Mapping *mappings, Result &result) {
+  volatile unsigned char sink = 0;
+  // Returns the mapping of a traced handle with a live replay handle.
+  auto find = [&](const handle_pool::TraceRecord &record) -> Mapping * {
+    Mapping &mapping = mappings[record.index];
+    if (mapping.generation.load(std::memory_order_acquire) !=
+            record.generation ||
+        !mapping.live.load(std::memory_order_acquire)) {
+      ++result.unmapped;
+      return nullptr;
+    }
+    return &mapping;
+  };
+  for (const auto &record : records) {
+    if (config.timed) {
+      std::this_thread::sleep_until(
+          start + std::chrono::nanoseconds(record.timestamp_ns));
+    }
+    ++result.ops[static_cast<size_t>(record.op)];
+    switch (record.op) {
+    case handle_pool::TraceOp::kCreate: {
+      const handle_pool::Handle handle = pool.Create();
+      if (handle == handle_pool::Handle::Invalid()) {
+        ++result.failed_creates;
+        break;
+      }
+      Mapping &mapping = mappings[record.index];
+      mapping.handle.store(handle.Pack(), std::memory_order_relaxed);
+      mapping.generation.store(record.generation, std::memory_order_release);
+      mapping.live.store(true, std::memory_order_release);
+      break;
+    }
+    case handle_pool::TraceOp::kDestroy: {
+      Mapping *mapping = find(record);
+      if (mapping == nullptr) {
+        break;
+      }
+      mapping->live.store(false, std::memory_order_release);
+      pool.Destroy(handle_pool::Handle::Unpack(
+          mapping->handle.load(std::memory_order_relaxed)));
+      break;
+    }
+    case handle_pool::TraceOp::kGet: {
+      Mapping *mapping = find(record);
+      if (mapping == nullptr) {
+        break;
+      }
+      auto obj = pool.Get(handle_pool::Handle::Unpack(
+          mapping->handle.load(std::memory_order_relaxed)));
+      if (obj.has_value()) {
+        sink = sink + obj.value().get().bytes[0];
+      }
+      break;
+    }
+    case handle_pool::TraceOp::kGetMiss:
+      pool.Get(handle_pool::Handle::Invalid());
+      break;
+    }
+  }
+}
+
+template <size_t Bytes>
+Result Replay(const Config &config,
+              const std::vector<handle_pool::TraceRecord> &records) {
+  using Pool = handle_pool::HandlePool<Object<Bytes>>;
+  handle_pool::HandlePoolOptions options;
+  options.initial_capacity = config.capacity;
+  options.max_capacity = config.max_capacity;
+  options.auto_size = config.auto_size;
+
+  const std::vector<std::vector<handle_pool::TraceRecord>> split =
+      SplitByThread(records);
+  uint32_t max_index = 0;
+  for (const auto &record : records) {
+    max_index = std::max(max_index, record.index);
+  }
+
+  Result result;
+  for (size_t round = 0; round < config.repeat; ++round) {
+    Pool pool(options);
+    // Allocated up front so that the timed loop only indexes into it.
+    std::unique_ptr<Mapping[]> mappings(new Mapping[size_t{max_index} + 1]);
+    std::vector<Result> results(split.size());
+    std::atomic<bool> go{false};
+    std::chrono::steady_clock::time_point start;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < split.size(); ++t) {
+      threads.emplace_back([&, t] {
+        while (!go.load(std::memory_order_acquire)) {
+          std::this_thread::yield();
+        }
+        ReplayThread(config, split[t], start, pool, mappings.get(),
+                     results[t]);
+      });
+    }
+    start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    result.elapsed += std::chrono::steady_clock::now() - start;
+
+    for (const Result &r : results) {
+      for (size_t op = 0; op < handle_pool::kTraceOpCount; ++op) {
+        result.ops[op] += r.ops[op];
+      }
+      result.failed_creates += r.failed_creates;
+      result.unmapped += r.unmapped;
+    }
+  }
+  return result;
+}
+
+bool ParseFlag(const std::string &arg, const std::string &name,
+               std::string *value) {
+  const std::string prefix = "--" + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  *value = arg.substr(prefix.size());
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Config config;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    std::string value;
+    if (ParseFlag(arg, "trace", &value)) {
+      config.trace = value;
+    } else if (ParseFlag(arg, "capacity", &value)) {
+      config.capacity = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (ParseFlag(arg, "max_capacity", &value)) {
+      config.max_capacity = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (arg == "--auto_size") {
+      config.auto_size = true;
+    } else if (ParseFlag(arg, "object_bytes", &value)) {
+      config.object_bytes = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (ParseFlag(arg, "timing", &value) &&
+               (value == "asap" || value == "timed")) {
+      config.timed = (value == "timed");
+    } else if (ParseFlag(arg, "repeat", &value)) {
+      config.repeat = std::max<size_t>(
+          1, std::strtoull(value.c_str(), nullptr, 10));
+    } else {
+      std::cerr << "unknown flag: " << arg << "\n";
+      return 2;
+    }
+  }
+  if (config.trace.empty()) {
+    std::cerr << "--trace is required\n";
+    return 2;
+  }
+
+  const auto records = handle_pool::OpTrace::ReadFile(config.trace);
+  if (!records.has_value()) {
+    std::cerr << "cannot read trace " << config.trace << "\n";
+    return 1;
+  }
+  std::vector<handle_pool::TraceRecord> ordered = *records;
+  std::stable_sort(ordered.begin(), ordered.end(),
+                   [](const auto &a, const auto &b) {
+                     return a.timestamp_ns < b.timestamp_ns;
+                   });
+  if (config.capacity == 0) {
+    // Default to the peak number of live objects in the trace.
+    size_t live = 0;
+    for (const auto &record : ordered) {
+      live += record.op == handle_pool::TraceOp::kCreate;
+      live -= record.op == handle_pool::TraceOp::kDestroy && live > 0;
+      config.capacity = std::max(config.capacity, live);
+    }
+    config.capacity = std::max<size_t>(config.capacity, 1);
+  }
+
+  Result result;
+  switch (config.object_bytes) {
+  case 16:
+    result = Replay<16>(config, ordered);
+    break;
+  case 64:
+    result = Replay<64>(config, ordered);
+    break;
+  case 256:
+    result = Replay<256>(config, ordered);
+    break;
+  case 1024:
+    result = Replay<1024>(config, ordered);
+    break;
+  default:
+    std::cerr << "--object_bytes must be 16, 64, 256 or 1024\n";
+    return 2;
+  }
+
+  const size_t total = ordered.size() * config.repeat;
+  std::cout << "records:         " << ordered.size() << "\n"
+            << "creates:         " << result.ops[0] << "\n"
+            << "destroys:        " << result.ops[1] << "\n"
+            << "gets:            " << result.ops[2] << "\n"
+            << "get misses:      " << result.ops[3] << "\n"
+            << "failed creates:  " << result.failed_creates << "\n"
+            << "unmapped:        " << result.unmapped << "\n"
+            << "elapsed (ms):    " << result.elapsed.count() / 1e6 << "\n"
+            << "ns/op:           "
+            << (total ? static_cast<double>(result.elapsed.count()) / total
+                      : 0.0)
+            << "\n";
+  return 0;
+}
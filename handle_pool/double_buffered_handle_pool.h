@@ -0,0 +1,296 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "handle_pool/handle_pool.h"
+#include "rwlock/rw_lock.h"
+#include "rwlock/unique_lock.h"
+
+namespace handle_pool {
+
+/*
+ * A pool for frame-based simulation that keeps two copies of every object
+ * under one handle space.
+ *
+ * Writers (`Create`, `Destroy`, `Get`) work on the back buffer, i.e. the
+ * next frame. Readers take a `ReadView` of the front buffer, i.e. the last
+ * published frame, without taking any lock. `Swap` publishes the back buffer
+ * as the new front, waits for readers still on the old front to finish, and
+ * then brings the old front up to date by copying only the slots written
+ * during the frame.
+ *
+ * Thread-safety:
+ * - Writer calls and `Swap` serialize on an exclusive lock.
+ * - `Read` and `ReadView` are lock-free. A `ReadView` held across a `Swap`
+ * delays that `Swap` until the view is released; it never sees the writes
+ * of a frame that has not been published yet.
+ */
+template <typename T> class DoubleBufferedHandlePool {
+  static_assert(std::is_copy_constructible_v<T>,
+                "DoubleBufferedHandlePool copies dirty objects between "
+                "buffers; T must be copy-constructible");
+
+public:
+  // A pinned, read-only view of the front buffer.
+  class ReadView {
+  public:
+    ReadView(ReadView &&other) noexcept
+        : pool_(std::exchange(other.pool_, nullptr)), buffer_(other.buffer_) {}
+    ReadView &operator=(ReadView &&) = delete;
+    ReadView(const ReadView &) = delete;
+    ReadView &operator=(const ReadView &) = delete;
+
+    ~ReadView() {
+      if (pool_ != nullptr) {
+        pool_->readers_[buffer_].count.fetch_sub(1, std::memory_order_release);
+      }
+    }
+
+    // Returns an optional reference to the published T, else nullopt.
+    std::optional<std::reference_wrapper<const T>>
+    Get(const Handle &handle) const {
+      if (!IsValid(handle)) {
+        return std::nullopt;
+      }
+      const Item &item = pool_->buffers_[buffer_][handle.index];
+      return std::cref(*reinterpret_cast<const T *>(&item.storage));
+    }
+
+    // Checks if the handle was live in the published frame.
+    bool IsValid(const Handle &handle) const {
+      return pool_->IsValidIn(buffer_, handle);
+    }
+
+  private:
+    friend class DoubleBufferedHandlePool;
+
+    ReadView(const DoubleBufferedHandlePool *pool, const uint32_t buffer)
+        : pool_(pool), buffer_(buffer) {}
+
+    const DoubleBufferedHandlePool *pool_;
+    uint32_t buffer_;
+  };
+
+  explicit DoubleBufferedHandlePool(const size_t capacity)
+      : capacity_(capacity) {
+    assert(capacity_ > 0);
+    for (auto &buffer : buffers_) {
+      buffer.reset(new Item[capacity_]);
+    }
+    is_dirty_.resize(capacity_, false);
+    dirty_.reserve(capacity_);
+    free_list_.reserve(capacity_);
+    for (uint32_t i = 0; i < capacity_; ++i) {
+      free_list_.push_back(i);
+    }
+  }
+
+  // Destructor cleans up all used items in both buffers.
+  ~DoubleBufferedHandlePool() {
+    rwlock::UniqueLock ul(rwlock_);
+    for (auto &buffer : buffers_) {
+      for (size_t i = 0; i < capacity_; ++i) {
+        if (buffer[i].in_use) {
+          reinterpret_cast<T *>(&buffer[i].storage)->~T();
+        }
+      }
+    }
+  }
+
+  // Creates a new T in the next frame, returning a handle. Readers see it
+  // after the next `Swap`.
+  template <typename... Args> const Handle Create(Args &&...args) {
+    rwlock::UniqueLock l(rwlock_);
+
+    if (free_list_.empty()) {
+      return Handle::Invalid();
+    }
+    const uint32_t slot = free_list_.back();
+    free_list_.pop_back();
+
+    Item &item = Back()[slot];
+    try {
+      new (&item.storage) T(std::forward<Args>(args)...);
+      item.in_use = true;
+    } catch (...) {
+      // If constructor throws, put the slot back.
+      free_list_.push_back(slot);
+      return Handle::Invalid();
+    }
+
+    MarkDirty(slot);
+    return Handle{slot, item.generation};
+  }
+
+  // Destroys the T in the next frame. Readers stop seeing it after the next
+  // `Swap`.
+  bool Destroy(const Handle &handle) {
+    rwlock::UniqueLock l(rwlock_);
+
+    if (!IsValidIn(back_index(), handle)) {
+      return false;
+    }
+    Item &item = Back()[handle.index];
+    reinterpret_cast<T *>(&item.storage)->~T();
+    item.in_use = false;
+    ++item.generation;
+    free_list_.push_back(handle.index);
+    MarkDirty(handle.index);
+    return true;
+  }
+
+  // Returns a reference to the next-frame T and marks it dirty, else
+  // nullopt. The reference is valid until the next `Swap`.
+  std::optional<std::reference_wrapper<T>> Get(const Handle &handle) {
+    rwlock::UniqueLock l(rwlock_);
+
+    if (!IsValidIn(back_index(), handle)) {
+      return std::nullopt;
+    }
+    MarkDirty(handle.index);
+    return std::ref(*reinterpret_cast<T *>(&Back()[handle.index].storage));
+  }
+
+  // Checks if the handle is live in the next frame.
+  bool IsValid(const Handle &handle) {
+    rwlock::UniqueLock l(rwlock_);
+    return IsValidIn(back_index(), handle);
+  }
+
+  // Pins the front buffer for lock-free reads.
+  ReadView Read() const {
+    for (;;) {
+      const uint32_t front = front_.load(std::memory_order_seq_cst);
+      readers_[front].count.fetch_add(1, std::memory_order_seq_cst);
+      if (front_.load(std::memory_order_seq_cst) == front) {
+        return ReadView(this, front);
+      }
+      // Lost a race with Swap; unpin and retry on the new front.
+      readers_[front].count.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  // Publishes the next frame and copies this frame's dirty slots into the
+  // new back buffer. Returns the number of slots copied.
+  size_t Swap() {
+    rwlock::UniqueLock l(rwlock_);
+
+    const uint32_t old_front = front_.load(std::memory_order_relaxed);
+    front_.store(1 - old_front, std::memory_order_seq_cst);
+    while (readers_[old_front].count.load(std::memory_order_seq_cst) != 0) {
+      std::this_thread::yield();
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    const Item *src = buffers_[1 - old_front].get();
+    Item *dst = buffers_[old_front].get();
+    for (const uint32_t slot : dirty_) {
+      CopySlot(src[slot], dst[slot]);
+      is_dirty_[slot] = false;
+    }
+    const size_t copied = dirty_.size();
+    dirty_.clear();
+    return copied;
+  }
+
+  inline constexpr size_t Capacity() const { return capacity_; }
+
+  // Returns true if there are no live objects in the next frame.
+  bool Empty() {
+    rwlock::UniqueLock l(rwlock_);
+    return (free_list_.size() == capacity_);
+  }
+
+  // Returns how many free slots remain in the next frame.
+  size_t Free() {
+    rwlock::UniqueLock l(rwlock_);
+    return free_list_.size();
+  }
+
+  // Disallow copy (owning resource).
+  DoubleBufferedHandlePool(const DoubleBufferedHandlePool &) = delete;
+  DoubleBufferedHandlePool &
+  operator=(const DoubleBufferedHandlePool &) = delete;
+
+private:
+  struct Item {
+    alignas(T) unsigned char storage[sizeof(T)];
+    uint32_t generation = 0;
+    bool in_use = false;
+  };
+
+  // Keeps the two reader counts on separate cache lines.
+  struct alignas(64) ReaderCount {
+    std::atomic<uint32_t> count{0};
+  };
+
+  uint32_t back_index() const {
+    return 1 - front_.load(std::memory_order_relaxed);
+  }
+
+  Item *Back() { return buffers_[back_index()].get(); }
+
+  void MarkDirty(const uint32_t slot) {
+    if (!is_dirty_[slot]) {
+      is_dirty_[slot] = true;
+      dirty_.push_back(slot);
+    }
+  }
+
+  // Makes `dst` hold the same object state as `src`.
+  static void CopySlot(const Item &src, Item &dst) {
+    const T *from = reinterpret_cast<const T *>(&src.storage);
+    T *to = reinterpret_cast<T *>(&dst.storage);
+    if constexpr (std::is_copy_assignable_v<T>) {
+      if (src.in_use && dst.in_use && src.generation == dst.generation) {
+        *to = *from;
+        return;
+      }
+    }
+    if (dst.in_use) {
+      to->~T();
+      dst.in_use = false;
+    }
+    if (src.in_use) {
+      new (&dst.storage) T(*from);
+      dst.in_use = true;
+    }
+    dst.generation = src.generation;
+  }
+
+  // Checks validity against one buffer without locking.
+  bool IsValidIn(const uint32_t buffer, const Handle &handle) const {
+    if (handle.index >= capacity_ || handle == Handle::Invalid()) {
+      return false;
+    }
+    const Item &item = buffers_[buffer][handle.index];
+    return item.in_use && (item.generation == handle.generation);
+  }
+
+  const size_t capacity_{0};
+
+  std::unique_ptr<Item[]> buffers_[2];
+  // Index of the published buffer; the other one is written.
+  std::atomic<uint32_t> front_{0};
+  mutable ReaderCount readers_[2];
+
+  // Slots written since the last Swap.
+  std::vector<uint32_t> dirty_;
+  std::vector<bool> is_dirty_;
+  std::vector<uint32_t> free_list_;
+
+  // Serializes writers and Swap (back buffer, dirty_ and free_list_).
+  rwlock::RWLock rwlock_;
+};
+
+} // namespace handle_pool
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "handle_pool/handle_pool.h"
+
+namespace handle_pool {
+
+/*
+ * A bounded, lock-free, multi-producer multi-consumer FIFO of handles, for
+ * passing ownership of pooled objects between threads.
+ *
+ * This is a ring of cells that each carry a sequence number next to a
+ * packed 64-bit handle. Producers claim cells by advancing `tail_` and
+ * consumers by advancing `head_`; a cell's sequence tells whether it is free
+ * for the producer at that position or ready for the consumer. Batch
+ * operations claim a run of consecutive cells with a single CAS. `head_` and
+ * `tail_` sit on separate cache lines so producers and consumers do not
+ * contend on them.
+ *
+ * Thread-safety: every method may be called concurrently.
+ */
+class HandleChannel {
+public:
+  // `capacity` must be a power of two.
+  explicit HandleChannel(const size_t capacity)
+      : mask_(capacity - 1), cells_(new Cell[capacity]) {
+    assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+    for (size_t i = 0; i < capacity; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Returns false if the channel is full.
+  bool TryPush(const Handle &handle) { return TryPushBatch(&handle, 1) == 1; }
+
+  // Returns nullopt if the channel is empty.
+  std::optional<Handle> TryPop() {
+    std::optional<Handle> result;
+    PopInto(1, [&](const uint64_t word) {
+      result.emplace(Handle::Unpack(word));
+    });
+    return result;
+  }
+
+  // Pushes up to `count` handles in order, returning how many fit.
+  size_t TryPushBatch(const Handle *handles, const size_t count) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      size_t n = 0;
+      while (n < count && n <= mask_ && Sequence(pos + n) == pos + n) {
+        ++n;
+      }
+      if (n == 0) {
+        if (count == 0 || Lag(Sequence(pos), pos) < 0) {
+          return 0; // Full.
+        }
+        pos = tail_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (tail_.compare_exchange_weak(pos, pos + n,
+                                      std::memory_order_relaxed)) {
+        for (size_t i = 0; i < n; ++i) {
+          Cell &cell = cells_[(pos + i) & mask_];
+          cell.value = handles[i].Pack();
+          cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return n;
+      }
+    }
+  }
+
+  // Pops up to `max_count` handles in order, appending them to `out`.
+  // Returns how many were popped. If `out` cannot grow, throws before
+  // popping anything.
+  size_t TryPopBatch(std::vector<Handle> &out, const size_t max_count) {
+    const size_t room = std::min(max_count, Capacity());
+    if (out.capacity() - out.size() < room) {
+      out.reserve(std::max(out.size() + room, 2 * out.capacity()));
+    }
+    return PopInto(max_count, [&](const uint64_t word) {
+      out.push_back(Handle::Unpack(word));
+    });
+  }
+
+  size_t Capacity() const { return mask_ + 1; }
+
+  // Number of queued handles; only a snapshot under concurrency.
+  size_t SizeApprox() const {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t head = head_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+  // Disallow copy (owning resource).
+  HandleChannel(const HandleChannel &) = delete;
+  HandleChannel &operator=(const HandleChannel &) = delete;
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    // Packed Handle; published by the release store to `sequence`.
+    uint64_t value;
+  };
+
+  size_t Sequence(const size_t pos) const {
+    return cells_[pos & mask_].sequence.load(std::memory_order_acquire);
+  }
+
+  static intptr_t Lag(const size_t sequence, const size_t pos) {
+    return static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+  }
+
+  // Claims up to `max_count` ready cells and passes each value to `out`,
+  // which must not throw: a claimed cell that is never released stalls
+  // every producer that reaches it.
+  template <typename Out> size_t PopInto(const size_t max_count, Out &&out) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      size_t n = 0;
+      while (n < max_count && n <= mask_ &&
+             Sequence(pos + n) == pos + n + 1) {
+        ++n;
+      }
+      if (n == 0) {
+        if (max_count == 0 || Lag(Sequence(pos), pos + 1) < 0) {
+          return 0; // Empty.
+        }
+        pos = head_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (head_.compare_exchange_weak(pos, pos + n,
+                                      std::memory_order_relaxed)) {
+        for (size_t i = 0; i < n; ++i) {
+          Cell &cell = cells_[(pos + i) & mask_];
+          const uint64_t word = cell.value;
+          cell.sequence.store(pos + i + mask_ + 1, std::memory_order_release);
+          out(word);
+        }
+        return n;
+      }
+    }
+  }
+
+  const size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+
+  // Next position to pop; on its own cache line.
+  alignas(64) std::atomic<size_t> head_{0};
+  // Next position to push; on its own cache line.
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+} // namespace handle_pool
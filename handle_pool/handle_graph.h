@@ -0,0 +1,466 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "handle_pool/handle_pool.h"
+#include "rwlock/rw_lock.h"
+#include "rwlock/shared_lock.h"
+#include "rwlock/unique_lock.h"
+
+namespace handle_pool {
+
+/*
+ * A directed graph whose vertices (carrying a V) and edges (carrying an E)
+ * live in two HandlePools and are named by Handles, so the graph can churn
+ * without fragmenting the heap and a stale vertex or edge handle is detected
+ * instead of dangling.
+ *
+ * Adjacency is stored per vertex chunk, the vertices whose indices share a
+ * chunk of the vertex pool. Each chunk has one array of out-edge entries and
+ * one of in-edge entries, and each of its vertices owns a run of both. An
+ * entry holds an edge and the vertex at its other end, so a traversal scans
+ * contiguous entries without touching the edge pool.
+ * - `RemoveEdge` marks the edge's two entries dead and destroys it, in O(1).
+ * - `RemoveVertex` removes the vertex with all of its in- and out-edges, in
+ *   O(degree), so no edge outlives its endpoints.
+ * A full run first drops its dead entries if they make up half of it, and
+ * otherwise moves to the end of its array with twice the room. An array is
+ * rewritten in vertex order once runs it no longer holds would fill half of
+ * it. `Compact` drops the dead entries of the given vertices.
+ *
+ * Thread-safety:
+ * - `AddVertex`, `AddEdge`, `RemoveVertex`, `RemoveEdge` and `Compact` use
+ * an exclusive lock.
+ * - All other methods use a shared lock. References returned by `Vertex`
+ * and `Edge` stay valid until the vertex or edge is removed. Callbacks must
+ * not call back into the graph.
+ * Every pool operation happens under the graph's lock, so lookups read the
+ * pools without taking their locks.
+ */
+template <typename V, typename E> class HandleGraph {
+public:
+  HandleGraph(const size_t vertex_capacity, const size_t edge_capacity)
+      : vertices_(vertex_capacity), edges_(edge_capacity),
+        adjacency_((vertices_.MaxCapacity() + kVerticesPerChunk - 1) /
+                   kVerticesPerChunk) {}
+
+  // Adds a vertex holding V(args...). Returns Handle::Invalid() if the
+  // vertex pool is full.
+  template <typename... Args> const Handle AddVertex(Args &&...args) {
+    rwlock::UniqueLock l(rwlock_);
+    return vertices_.Create(std::forward<Args>(args)...);
+  }
+
+  // Adds an edge from -> to holding E(args...). Returns Handle::Invalid()
+  // if either endpoint is invalid or the edge pool is full.
+  template <typename... Args>
+  const Handle AddEdge(const Handle &from, const Handle &to, Args &&...args) {
+    rwlock::UniqueLock l(rwlock_);
+
+    if (!vertices_.IsValidInternal(from) || !vertices_.IsValidInternal(to)) {
+      return Handle::Invalid();
+    }
+    // Make room first, so that nothing fails once the edge exists.
+    Adjacency &out = OutOf(from.index);
+    Adjacency &in = InOf(to.index);
+    MakeRoom(out, RunOf(out, from.index), &EdgeNode::out_slot);
+    MakeRoom(in, RunOf(in, to.index), &EdgeNode::in_slot);
+    Run &out_run = RunOf(out, from.index);
+    Run &in_run = RunOf(in, to.index);
+
+    const Handle edge =
+        edges_.Create(from.Pack(), to.Pack(), out_run.size, in_run.size,
+                      std::forward<Args>(args)...);
+    if (edge == Handle::Invalid()) {
+      return edge;
+    }
+    Append(out, out_run, Entry{edge.Pack(), to.Pack()});
+    Append(in, in_run, Entry{edge.Pack(), from.Pack()});
+    return edge;
+  }
+
+  // Removes the vertex and every edge into or out of it. Returns false if
+  // the handle is invalid.
+  bool RemoveVertex(const Handle &vertex) {
+    rwlock::UniqueLock l(rwlock_);
+
+    if (!vertices_.IsValidInternal(vertex)) {
+      return false;
+    }
+    // An out-edge's entry at its target, and an in-edge's at its source,
+    // die with the edge. A self-loop is gone by the time the in-edges are.
+    Adjacency &out = OutOf(vertex.index);
+    Run &out_run = RunOf(out, vertex.index);
+    for (uint32_t i = 0; i < out_run.size; ++i) {
+      const Entry &entry = out.entries[out_run.begin + i];
+      if (entry.edge != kNoEdge) {
+        const Handle target = Handle::Unpack(entry.vertex);
+        Kill(InOf(target.index), target.index,
+             Find(edges_, Handle::Unpack(entry.edge))->in_slot);
+        edges_.Destroy(Handle::Unpack(entry.edge));
+      }
+    }
+    Release(out, out_run);
+
+    Adjacency &in = InOf(vertex.index);
+    Run &in_run = RunOf(in, vertex.index);
+    for (uint32_t i = 0; i < in_run.size; ++i) {
+      const Entry &entry = in.entries[in_run.begin + i];
+      if (entry.edge != kNoEdge) {
+        const Handle source = Handle::Unpack(entry.vertex);
+        Kill(OutOf(source.index), source.index,
+             Find(edges_, Handle::Unpack(entry.edge))->out_slot);
+        edges_.Destroy(Handle::Unpack(entry.edge));
+      }
+    }
+    Release(in, in_run);
+    return vertices_.Destroy(vertex);
+  }
+
+  // Removes the edge. Returns false if it is invalid.
+  bool RemoveEdge(const Handle &edge) {
+    rwlock::UniqueLock l(rwlock_);
+
+    const EdgeNode *e = Find(edges_, edge);
+    if (e == nullptr) {
+      return false;
+    }
+    const uint32_t from = Handle::Unpack(e->from).index;
+    const uint32_t to = Handle::Unpack(e->to).index;
+    Kill(OutOf(from), from, e->out_slot);
+    Kill(InOf(to), to, e->in_slot);
+    return edges_.Destroy(edge);
+  }
+
+  bool HasVertex(const Handle &vertex) const {
+    rwlock::SharedLock l(rwlock_);
+    return vertices_.IsValidInternal(vertex);
+  }
+
+  bool HasEdge(const Handle &edge) const {
+    rwlock::SharedLock l(rwlock_);
+    return Find(edges_, edge) != nullptr;
+  }
+
+  std::optional<std::reference_wrapper<V>> Vertex(const Handle &vertex) {
+    rwlock::SharedLock l(rwlock_);
+
+    V *v = Find(vertices_, vertex);
+    if (v == nullptr) {
+      return std::nullopt;
+    }
+    return std::ref(*v);
+  }
+
+  std::optional<std::reference_wrapper<E>> Edge(const Handle &edge) {
+    rwlock::SharedLock l(rwlock_);
+
+    EdgeNode *e = Find(edges_, edge);
+    if (e == nullptr) {
+      return std::nullopt;
+    }
+    return std::ref(e->value);
+  }
+
+  // Returns the (source, target) of a valid edge, else nullopt.
+  std::optional<std::pair<Handle, Handle>>
+  Endpoints(const Handle &edge) const {
+    rwlock::SharedLock l(rwlock_);
+
+    const EdgeNode *e = Find(edges_, edge);
+    if (e == nullptr) {
+      return std::nullopt;
+    }
+    return std::make_pair(Handle::Unpack(e->from), Handle::Unpack(e->to));
+  }
+
+  // Calls fn(edge, target) for each out-edge of the vertex, in the order
+  // they were added. Returns false if the vertex is invalid.
+  template <typename Fn>
+  bool ForEachOutEdge(const Handle &vertex, Fn &&fn) const {
+    rwlock::SharedLock l(rwlock_);
+    return ForEachOutEdgeInternal(vertex, fn);
+  }
+
+  // Number of out-edges of the vertex (0 if it is invalid).
+  size_t OutDegree(const Handle &vertex) const {
+    rwlock::SharedLock l(rwlock_);
+
+    if (!vertices_.IsValidInternal(vertex)) {
+      return 0;
+    }
+    const Adjacency &out = adjacency_[vertex.index / kVerticesPerChunk].out;
+    return out.runs[vertex.index % kVerticesPerChunk].live;
+  }
+
+  // Visits the vertices reachable from `source` in breadth-first order,
+  // calling fn(vertex, depth) on each. Returns the number visited.
+  template <typename Fn> size_t Bfs(const Handle &source, Fn &&fn) const {
+    rwlock::SharedLock l(rwlock_);
+
+    if (!vertices_.IsValidInternal(source)) {
+      return 0;
+    }
+    // Indexed by vertex index; vertex indices are below MaxCapacity.
+    std::vector<bool> seen(vertices_.MaxCapacity());
+    std::vector<uint64_t> frontier{source.Pack()}, next;
+    seen[source.index] = true;
+    size_t visited = 0;
+    auto visit = [&](const Handle &, const Handle &target) {
+      if (!seen[target.index]) {
+        seen[target.index] = true;
+        next.push_back(target.Pack());
+      }
+    };
+    for (size_t depth = 0; !frontier.empty(); ++depth) {
+      for (const uint64_t packed : frontier) {
+        const Handle vertex = Handle::Unpack(packed);
+        fn(vertex, depth);
+        ++visited;
+        ForEachOutEdgeInternal(vertex, visit);
+      }
+      frontier.swap(next);
+      next.clear();
+    }
+    return visited;
+  }
+
+  // Drops the dead adjacency entries of the given vertices.
+  void Compact(const std::vector<Handle> &vertices) {
+    rwlock::UniqueLock l(rwlock_);
+
+    for (const Handle &vertex : vertices) {
+      if (vertices_.IsValidInternal(vertex)) {
+        Adjacency &out = OutOf(vertex.index);
+        Adjacency &in = InOf(vertex.index);
+        DropDead(out, RunOf(out, vertex.index), &EdgeNode::out_slot);
+        DropDead(in, RunOf(in, vertex.index), &EdgeNode::in_slot);
+      }
+    }
+  }
+
+  // Number of vertices.
+  size_t VertexCount() const {
+    return vertices_.Capacity() - vertices_.Free();
+  }
+
+  // Number of edges.
+  size_t EdgeCount() const { return edges_.Capacity() - edges_.Free(); }
+
+  // Disallow copy (owning resource).
+  HandleGraph(const HandleGraph &) = delete;
+  HandleGraph &operator=(const HandleGraph &) = delete;
+
+private:
+  // Edge of a dead entry; equals Handle::Invalid().Pack().
+  static constexpr uint64_t kNoEdge = std::numeric_limits<uint32_t>::max();
+  // Vertices per adjacency chunk: one chunk of the vertex pool.
+  static constexpr size_t kVerticesPerChunk = HandlePool<V>::ChunkCapacity();
+  // Room of a vertex's first run.
+  static constexpr uint32_t kMinRun = 4;
+
+  struct EdgeNode {
+    template <typename... Args>
+    EdgeNode(const uint64_t from, const uint64_t to, const uint32_t out_slot,
+             const uint32_t in_slot, Args &&...args)
+        : value(std::forward<Args>(args)...), from(from), to(to),
+          out_slot(out_slot), in_slot(in_slot) {}
+
+    E value;
+    // Packed vertex handles.
+    uint64_t from;
+    uint64_t to;
+    // Positions of the edge's entries in the runs of `from` and `to`.
+    uint32_t out_slot;
+    uint32_t in_slot;
+  };
+
+  // Packed handles of an edge (kNoEdge once it is removed) and of the
+  // vertex at its other end.
+  struct Entry {
+    uint64_t edge;
+    uint64_t vertex;
+  };
+
+  // A vertex's entries: `size` used, `live` of them not dead, out of room
+  // for `capacity` starting at `begin`.
+  struct Run {
+    uint32_t begin = 0;
+    uint32_t size = 0;
+    uint32_t capacity = 0;
+    uint32_t live = 0;
+  };
+
+  // One direction of a vertex chunk's adjacency.
+  struct Adjacency {
+    Adjacency() : runs(kVerticesPerChunk) {}
+
+    std::vector<Entry> entries;
+    // By vertex index within the chunk.
+    std::vector<Run> runs;
+    // Entries that no run holds any more.
+    size_t abandoned = 0;
+  };
+
+  struct AdjacencyChunk {
+    Adjacency out;
+    Adjacency in;
+  };
+
+  // Returns the node of a valid handle, or nullptr, without taking the
+  // pool's lock (graph lock held; exclusive to write through the result).
+  template <typename Node>
+  static Node *Find(HandlePool<Node> &pool, const Handle &handle) {
+    if (!pool.IsValidInternal(handle)) {
+      return nullptr;
+    }
+    return reinterpret_cast<Node *>(
+        &pool.ItemAt(pool.slots_[handle.index].position).storage);
+  }
+
+  template <typename Node>
+  static const Node *Find(const HandlePool<Node> &pool, const Handle &handle) {
+    if (!pool.IsValidInternal(handle)) {
+      return nullptr;
+    }
+    return reinterpret_cast<const Node *>(
+        &pool.ItemAt(pool.slots_[handle.index].position).storage);
+  }
+
+  Adjacency &OutOf(const uint32_t vertex) {
+    return adjacency_[vertex / kVerticesPerChunk].out;
+  }
+
+  Adjacency &InOf(const uint32_t vertex) {
+    return adjacency_[vertex / kVerticesPerChunk].in;
+  }
+
+  static Run &RunOf(Adjacency &adjacency, const uint32_t vertex) {
+    return adjacency.runs[vertex % kVerticesPerChunk];
+  }
+
+  template <typename Fn>
+  bool ForEachOutEdgeInternal(const Handle &vertex, Fn &fn) const {
+    if (!vertices_.IsValidInternal(vertex)) {
+      return false;
+    }
+    const Adjacency &out = adjacency_[vertex.index / kVerticesPerChunk].out;
+    const Run &run = out.runs[vertex.index % kVerticesPerChunk];
+    const Entry *entry = out.entries.data() + run.begin;
+    for (const Entry *end = entry + run.size; entry != end; ++entry) {
+      if (entry->edge != kNoEdge) {
+        fn(Handle::Unpack(entry->edge), Handle::Unpack(entry->vertex));
+      }
+    }
+    return true;
+  }
+
+  // Makes room for one more entry in `run`, dropping its dead entries or
+  // moving it; `slot` is the member of EdgeNode that records positions in
+  // this direction (exclusive lock held).
+  void MakeRoom(Adjacency &adjacency, Run &run, uint32_t EdgeNode::*slot) {
+    if (run.size < run.capacity) {
+      return;
+    }
+    const uint32_t dead = run.size - run.live;
+    if (dead > 0 && 2 * dead >= run.size) {
+      DropDead(adjacency, run, slot);
+      return;
+    }
+    Relocate(adjacency, run, std::max(kMinRun, 2 * run.capacity));
+  }
+
+  // Moves `run` to the end of the entries with room for `capacity`, or
+  // rewrites them in vertex order if that leaves half of them abandoned.
+  // Positions within runs do not change (exclusive lock held).
+  void Relocate(Adjacency &adjacency, Run &run, const uint32_t capacity) {
+    std::vector<Entry> &entries = adjacency.entries;
+    if (2 * (adjacency.abandoned + run.capacity) <= entries.size()) {
+      const size_t begin = entries.size();
+      entries.resize(begin + capacity);
+      std::copy_n(entries.begin() + run.begin, run.size,
+                  entries.begin() + begin);
+      adjacency.abandoned += run.capacity;
+      run.begin = static_cast<uint32_t>(begin);
+      run.capacity = capacity;
+      return;
+    }
+    size_t total = capacity;
+    for (const Run &r : adjacency.runs) {
+      total += &r == &run ? 0 : r.capacity;
+    }
+    std::vector<Entry> rewritten;
+    rewritten.reserve(total);
+    for (Run &r : adjacency.runs) {
+      const size_t begin = rewritten.size();
+      rewritten.insert(rewritten.end(), entries.begin() + r.begin,
+                       entries.begin() + r.begin + r.size);
+      if (&r == &run) {
+        r.capacity = capacity;
+      }
+      rewritten.resize(begin + r.capacity);
+      r.begin = static_cast<uint32_t>(begin);
+    }
+    entries.swap(rewritten);
+    adjacency.abandoned = 0;
+  }
+
+  // Squeezes the dead entries out of `run`, updating the moved edges'
+  // positions (exclusive lock held).
+  void DropDead(Adjacency &adjacency, Run &run, uint32_t EdgeNode::*slot) {
+    Entry *entries = adjacency.entries.data() + run.begin;
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < run.size; ++i) {
+      if (entries[i].edge == kNoEdge) {
+        continue;
+      }
+      if (kept != i) {
+        entries[kept] = entries[i];
+        Find(edges_, Handle::Unpack(entries[kept].edge))->*slot = kept;
+      }
+      ++kept;
+    }
+    run.size = kept;
+  }
+
+  // Adds an entry to a run with room for it (exclusive lock held).
+  static void Append(Adjacency &adjacency, Run &run, const Entry &entry) {
+    adjacency.entries[run.begin + run.size] = entry;
+    ++run.size;
+    ++run.live;
+  }
+
+  // Marks the entry at `slot` of a vertex's run dead (exclusive lock held).
+  static void Kill(Adjacency &adjacency, const uint32_t vertex,
+                   const uint32_t slot) {
+    Run &run = RunOf(adjacency, vertex);
+    adjacency.entries[run.begin + slot].edge = kNoEdge;
+    --run.live;
+  }
+
+  // Gives up a removed vertex's run (exclusive lock held).
+  static void Release(Adjacency &adjacency, Run &run) {
+    adjacency.abandoned += run.capacity;
+    run = Run{};
+    if (adjacency.abandoned == adjacency.entries.size()) {
+      adjacency.entries.clear();
+      adjacency.abandoned = 0;
+    }
+  }
+
+  HandlePool<V> vertices_;
+  HandlePool<EdgeNode> edges_;
+  std::vector<AdjacencyChunk> adjacency_;
+
+  // Guards the graph's topology and serializes every pool operation.
+  mutable rwlock::RWLock rwlock_;
+};
+
+} // namespace handle_pool
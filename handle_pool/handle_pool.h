@@ -1,23 +1,52 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <new>
 #include <optional>
+#include <string>
+#include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <thread>
 #include <type_traits>
+#include <unistd.h>
 #include <utility>
 #include <vector>
 
+#include "handle_pool/op_trace.h"
 #include "rwlock/rw_lock.h"
 #include "rwlock/shared_lock.h"
 #include "rwlock/unique_lock.h"
 
+// Static tracepoints (USDT) for bpftrace and perf, compiled in with
+// -DHANDLE_POOL_ENABLE_USDT (`--define handle_pool_usdt=1` under Bazel; needs
+// <sys/sdt.h>). An unattached probe costs a nop. Probes of provider
+// `handle_pool`, where `pool` is the HandlePool's address:
+//   create(pool, index, generation)    destroy(pool, index, generation)
+//   get_miss(pool, index, generation)  pool_full(pool, capacity)
+#ifdef HANDLE_POOL_ENABLE_USDT
+#include <sys/sdt.h>
+#define HANDLE_POOL_PROBE2(name, a, b) DTRACE_PROBE2(handle_pool, name, a, b)
+#define HANDLE_POOL_PROBE3(name, a, b, c)                                      \
+  DTRACE_PROBE3(handle_pool, name, a, b, c)
+#else
+#define HANDLE_POOL_PROBE2(name, a, b) static_cast<void>(0)
+#define HANDLE_POOL_PROBE3(name, a, b, c) static_cast<void>(0)
+#endif
+
 namespace handle_pool {
 
 /*
@@ -36,6 +65,17 @@ struct Handle {
     return Handle(std::numeric_limits<uint32_t>::max(), 0);
   }
 
+  // Packs the handle into one 64-bit word (generation in the high half), for
+  // storing handles in atomics or untyped buffers.
+  uint64_t Pack() const {
+    return (static_cast<uint64_t>(generation) << 32) | index;
+  }
+
+  static const Handle Unpack(const uint64_t word) {
+    return Handle(static_cast<uint32_t>(word),
+                  static_cast<uint32_t>(word >> 32));
+  }
+
   bool operator==(const Handle &other) const {
     return (index == other.index) && (generation == other.generation);
   }
@@ -52,84 +92,375 @@ inline std::ostream &operator<<(std::ostream &os, const Handle &h) {
  * lightweight handles to them. The pool uses a free list and a
  * generation counter per slot to detect stale handles.
  *
+ * A handle's index names a slot, and each slot records the position of its
+ * object in `items_`. `Reorganize` uses that indirection to move frequently
+ * accessed objects to the front of `items_` without invalidating handles;
+ * references obtained from `Get` before a `Reorganize` are invalidated.
+ *
+ * `items_` is split into refcounted chunks so that `Clone` can share them
+ * copy-on-write: the first write to a shared chunk (`Create`, `Destroy` or a
+ * non-const `Get`) copies just that chunk. `CheckpointAsync` writes such a
+ * clone to disk in the background.
+ *
+ * A pool built from HandlePoolOptions with a `max_capacity` above its
+ * `initial_capacity` is growable: `Create` on a full pool adds a chunk of
+ * slots, and `Shrink` releases trailing chunks whose slots are all free. The
+ * handle indices of released slots are parked with their generations, so
+ * handles into them stay stale after the pool grows back. A growth gate (see
+ * PoolBudget) may veto growth.
+ *
+ * With `auto_size`, a growable pool also resizes itself: it grows
+ * geometrically while some slots are still free, so `Create` rarely finds
+ * it full, and it shrinks once occupancy has stayed low for several windows
+ * of operations. The gap between the grow and shrink thresholds keeps it
+ * from oscillating. The resize runs at the end of the `Create` or `Destroy`
+ * that triggered it, after the lock has been released.
+ *
+ * Objects created through `Create(TenantId, ...)` count against that
+ * tenant's TenantQuota. A tenant's unused reservation is withheld from
+ * everyone else (including untenanted `Create`), so a noisy tenant cannot
+ * starve the others of their reserved slots. Per-tenant object counts can be
+ * read without locking.
+ *
+ * `Reserve`, `PendingHandle::Construct` and `Publish` split `Create` in two so
+ * that an expensive constructor runs without the pool's lock. While a slot
+ * is reserved, its chunk is not shared with clones, `Reorganize` does
+ * nothing, and `Shrink` and `Freeze` leave the slot alone.
+ *
  * Thread-safety:
- * - `Create`, `Destroy`, and the destructor use an exclusive lock
- * (unique_lock).
- * - `Get` uses a shared lock (shared_lock).
+ * - `Create`, `Destroy`, `Grow`, `Shrink`, `Reorganize`, `Freeze`, `Clone`,
+ * `Reserve`, `Publish`, `Abandon` and the destructor use an exclusive lock
+ * (unique_lock). `Create`, `Reserve` and `Grow` call the growth gate without
+ * holding it.
+ * - `Get` uses a shared lock (shared_lock), and briefly an exclusive lock when
+ * a non-const `Get` has to copy a shared chunk.
  */
-template <typename T> class HandlePool {
+template <typename T> class FrozenHandlePool;
+template <typename T> class BatchExecutor;
+template <typename T> class HandlePool;
+template <typename V, typename E> class HandleGraph;
+
+// Names a tenant of a HandlePool, in [0, HandlePoolOptions::max_tenants).
+struct TenantId {
+  explicit TenantId(const uint32_t value) : value(value) {}
+
+  bool operator==(const TenantId &other) const { return value == other.value; }
+  bool operator!=(const TenantId &other) const { return !(*this == other); }
+
+  const uint32_t value;
+};
+
+// Per-tenant slot limits.
+struct TenantQuota {
+  // Slots kept free for the tenant while it holds fewer objects than this.
+  size_t reserved = 0;
+  // Objects the tenant may hold at once.
+  size_t max = std::numeric_limits<size_t>::max();
+};
+
+// Construction parameters for HandlePool.
+struct HandlePoolOptions {
+  // Slots available from construction.
+  size_t initial_capacity = 0;
+  // Upper bound for growth; 0 (or anything not above initial_capacity)
+  // makes the pool fixed-size.
+  size_t max_capacity = 0;
+
+  // Resize a growable pool from observed occupancy (see below).
+  bool auto_size = false;
+  // Grow once fewer than this fraction of the slots are free...
+  double grow_headroom = 0.125;
+  // ...by this fraction of the current capacity (at least one chunk).
+  double growth_factor = 0.5;
+  // `Create` and `Destroy` calls per occupancy window.
+  size_t window_ops = 1024;
+  // Shrink, down to twice the high-water mark, after this many consecutive
+  // windows whose high-water mark stayed below `shrink_occupancy` of the
+  // capacity.
+  size_t shrink_windows = 8;
+  double shrink_occupancy = 0.25;
+
+  // Number of tenants that `Create(TenantId, ...)` accepts.
+  uint32_t max_tenants = 0;
+
+  // mlock(2) object storage as it is allocated, so that it is resident and
+  // never paged out. Storage that cannot be locked (RLIMIT_MEMLOCK) stays
+  // unlocked; see `PinnedBytes`.
+  bool lock_memory = false;
+
+  // Threads used to allocate and initialize the initial chunks and slot
+  // metadata, and to destroy the chunks in the destructor. Each thread
+  // touches its chunks first, so their pages are placed on its NUMA node.
+  size_t init_threads = 1;
+  // Called at the start of each of those threads with its index, e.g. to
+  // set its CPU affinity.
+  std::function<void(size_t thread)> init_thread_setup = nullptr;
+};
+
+// Memory footprint of a HandlePool, from `HandlePool::MemoryStats`.
+struct HandlePoolMemoryStats {
+  // Object storage allocated (every chunk's items).
+  size_t reserved_bytes = 0;
+  // Part of reserved_bytes backed by resident pages.
+  size_t committed_bytes = 0;
+  // sizeof(T) times the number of live objects.
+  size_t live_bytes = 0;
+  // Per-slot overhead: Item padding and flag, slot table, free list and
+  // chunk table.
+  size_t metadata_bytes = 0;
+  // Fraction of resident storage pages holding at least one live object.
+  double live_page_fraction = 0.0;
+  // Fraction of cache lines in resident storage pages holding at least one
+  // live object.
+  double live_cache_line_fraction = 0.0;
+};
+
+// Decides whether a growable HandlePool may add `bytes` of storage. `grow`
+// performs the growth and returns false if the pool cannot grow after all;
+// a gate that admits the growth returns what `grow` returned.
+using GrowthGate =
+    std::function<bool(size_t bytes, const std::function<bool()> &grow)>;
+
+/*
+ * A slot reserved by `HandlePool::Reserve`. The owner constructs the object
+ * with `Construct`, which takes no pool lock, and then passes the
+ * PendingHandle to `HandlePool::Publish` (or `HandlePool::Abandon`). A
+ * PendingHandle destroyed while still reserved abandons its reservation, so
+ * an exception between `Reserve` and `Publish` does not leak the slot; it
+ * must not outlive its pool.
+ *
+ * `handle()` is the handle the object will have once published, so it can be
+ * handed out early; the pool treats it as invalid until `Publish`.
+ */
+template <typename T> class PendingHandle {
 public:
-  explicit HandlePool(const size_t capacity) : capacity_(capacity) {
-    assert(capacity_ > 0);
-    items_.reserve(capacity);
-    free_list_.reserve(capacity_);
-    for (uint32_t i = 0; i < capacity_; ++i) {
-      items_[i].in_use = false;
-      items_[i].generation = 0;
-      free_list_.push_back(i);
+  // An empty PendingHandle, as returned by `Reserve` on a full pool.
+  PendingHandle() = default;
+
+  PendingHandle(PendingHandle &&other) noexcept
+      : pool_(other.pool_), handle_(other.handle_), storage_(other.storage_),
+        constructed_(other.constructed_) {
+    other.Reset();
+  }
+
+  ~PendingHandle() {
+    if (IsReserved()) {
+      pool_->Abandon(*this);
     }
   }
 
-  // Destructor cleans up all used items.
+  // Constructs the object in the reserved slot; at most once.
+  template <typename... Args> T &Construct(Args &&...args) {
+    assert(IsReserved() && !constructed_);
+    T *obj = new (storage_) T(std::forward<Args>(args)...);
+    constructed_ = true;
+    return *obj;
+  }
+
+  const Handle handle() const { return Handle::Unpack(handle_); }
+
+  // False once published or abandoned, or if the reservation failed.
+  bool IsReserved() const { return storage_ != nullptr; }
+
+  bool IsConstructed() const { return constructed_; }
+
+  // Disallow copy (one owner per reservation).
+  PendingHandle(const PendingHandle &) = delete;
+  PendingHandle &operator=(const PendingHandle &) = delete;
+
+private:
+  friend class HandlePool<T>;
+
+  PendingHandle(HandlePool<T> *pool, const Handle &handle, void *storage)
+      : pool_(pool), handle_(handle.Pack()), storage_(storage) {}
+
+  void Reset() {
+    pool_ = nullptr;
+    handle_ = Handle::Invalid().Pack();
+    storage_ = nullptr;
+    constructed_ = false;
+  }
+
+  HandlePool<T> *pool_ = nullptr;
+  uint64_t handle_ = Handle::Invalid().Pack();
+  void *storage_ = nullptr;
+  bool constructed_ = false;
+};
+
+template <typename T> class HandlePool {
+public:
+  // One in this many `Get` calls per thread bumps the slot's heat counter.
+  static constexpr uint32_t kHeatSampleInterval = 8;
+
+  explicit HandlePool(const size_t capacity)
+      : HandlePool(HandlePoolOptions{capacity, capacity}) {}
+
+  // A growable pool's capacity changes by whole chunks, so its initial and
+  // maximum capacities are rounded up to multiples of ChunkCapacity().
+  explicit HandlePool(const HandlePoolOptions &options)
+      : options_(options),
+        min_capacity_(options.max_capacity > options.initial_capacity
+                          ? RoundUpToChunk(options.initial_capacity)
+                          : options.initial_capacity),
+        max_capacity_(options.max_capacity > options.initial_capacity
+                          ? RoundUpToChunk(options.max_capacity)
+                          : options.initial_capacity),
+        capacity_(min_capacity_),
+        tenants_(new Tenant[options.max_tenants]) {
+    assert(min_capacity_ > 0);
+    chunks_.resize((min_capacity_ + kItemsPerChunk - 1) / kItemsPerChunk);
+    slots_.resize(min_capacity_);
+    free_list_.resize(min_capacity_);
+    ParallelForChunks([this](const size_t c) {
+      const size_t begin = c * kItemsPerChunk;
+      const size_t end = std::min(begin + kItemsPerChunk, min_capacity_);
+      chunks_[c] = MakeChunk(end - begin);
+      for (size_t i = begin; i < end; ++i) {
+        slots_[i].position = static_cast<uint32_t>(i);
+        free_list_[i] = static_cast<uint32_t>(i);
+      }
+    });
+  }
+
+  // Destructor cleans up all used items (chunks still shared with a clone are
+  // left to the clone).
   ~HandlePool() {
     rwlock::UniqueLock ul(rwlock_);
-    for (auto &item : items_) {
-      if (item.in_use) {
-        reinterpret_cast<T *>(&item.storage)->~T();
-      }
-    }
+    ParallelForChunks([this](const size_t c) { chunks_[c].reset(); });
+    chunks_.clear();
   }
 
-  // Creates a new T in-place, returning a handle.
+  // Creates a new T in-place, returning a handle. A full growable pool first
+  // tries to `Grow`.
   // Exclusive lock because we modify shared data structures.
   template <typename... Args> const Handle Create(Args &&...args) {
-    rwlock::UniqueLock l(rwlock_);
+    Sizing sizing;
+    const Handle handle =
+        CreateInternal(sizing, kNoTenant, std::forward<Args>(args)...);
+    ApplySizing(sizing);
+    return handle;
+  }
 
-    if (free_list_.empty()) {
+  // Creates a new T on behalf of `tenant`, returning a handle;
+  // Handle::Invalid() if the tenant is unknown or at its quota, or if the
+  // only free slots are reserved for other tenants.
+  template <typename... Args>
+  const Handle Create(const TenantId tenant, Args &&...args) {
+    if (tenant.value >= options_.max_tenants) {
       return Handle::Invalid();
     }
-    const uint32_t slot = free_list_.back();
-    free_list_.pop_back();
+    Sizing sizing;
+    const Handle handle =
+        CreateInternal(sizing, tenant.value, std::forward<Args>(args)...);
+    ApplySizing(sizing);
+    return handle;
+  }
+
+  // First phase of a two-phase create: takes a free slot (growing a full
+  // growable pool, like `Create`) and returns it as a PendingHandle whose
+  // object the caller constructs without holding the pool's lock. The
+  // result is empty if the pool is full. Dropping the result abandons the
+  // reservation; it must be published or dropped before the pool is
+  // destroyed.
+  PendingHandle<T> Reserve() {
+    Sizing sizing;
+    PendingHandle<T> pending = ReserveInternal(sizing);
+    ApplySizing(sizing);
+    return pending;
+  }
 
-    Item &item = items_[slot];
-    try {
-      new (&item.storage) T(std::forward<Args>(args)...);
-      item.in_use = true;
-    } catch (...) {
-      // If constructor throws, put the slot back.
-      free_list_.push_back(slot);
+  // Makes the constructed object of a reservation visible to `Get` and
+  // `IsValid`, returning its handle. Returns Handle::Invalid() (and keeps
+  // the reservation) if nothing has been constructed, or if `pending` is not
+  // a reservation of this pool.
+  const Handle Publish(PendingHandle<T> &pending) {
+    rwlock::UniqueLock l(rwlock_);
+
+    if (!pending.IsConstructed() || !IsReservation(pending)) {
       return Handle::Invalid();
     }
+    const Handle handle = pending.handle();
+    Item &item = ReservedItemAt(slots_[handle.index].position);
+    item.reserved = false;
+    item.in_use = true;
+    EndReservation(handle.index);
+    HANDLE_POOL_PROBE3(create, this, handle.index, handle.generation);
+    Trace(TraceOp::kCreate, handle);
+    pending.Reset();
+    return handle;
+  }
 
-    return Handle{slot, item.generation};
+  // Gives a reservation's slot back, destroying its object if one was
+  // constructed. The reserved handle never becomes valid. Returns false if
+  // `pending` is not a reservation of this pool.
+  bool Abandon(PendingHandle<T> &pending) {
+    Sizing sizing;
+    {
+      rwlock::UniqueLock l(rwlock_);
+
+      if (!IsReservation(pending)) {
+        return false;
+      }
+      const uint32_t index = pending.handle().index;
+      Item &item = ReservedItemAt(slots_[index].position);
+      if (pending.IsConstructed()) {
+        reinterpret_cast<T *>(&item.storage)->~T();
+      }
+      item.reserved = false;
+      EndReservation(index);
+      ++slots_[index].generation;
+      free_list_.push_back(index);
+      sizing = RecordOccupancy();
+      pending.Reset();
+    }
+    ApplySizing(sizing);
+    return true;
   }
 
   // Destroy the T associated with the handle.
   // Exclusive lock because we modify shared data structures.
   bool Destroy(const Handle &handle) {
-    rwlock::UniqueLock l(rwlock_);
-
-    if (!IsValidInternal(handle)) {
-      return false;
+    Sizing sizing;
+    bool destroyed = false;
+    {
+      rwlock::UniqueLock l(rwlock_);
+      destroyed = DestroyInternal(handle, sizing);
     }
-
-    Item &item = items_[handle.index];
-    reinterpret_cast<T *>(&item.storage)->~T();
-    item.in_use = false;
-    ++item.generation;
-    free_list_.push_back(handle.index);
-    return true;
+    ApplySizing(sizing);
+    return destroyed;
   }
 
   // Returns an optional reference to T if the handle is valid, else nullopt.
-  // Shared lock because we only read shared data.
+  // Shared lock because we only read shared data, unless the object's chunk
+  // is shared with a clone and has to be copied first.
   std::optional<std::reference_wrapper<T>> Get(const Handle &handle) {
-    rwlock::SharedLock l(rwlock_);
+    {
+      rwlock::SharedLock l(rwlock_);
+
+      if (!IsValidInternal(handle)) {
+        HANDLE_POOL_PROBE3(get_miss, this, handle.index, handle.generation);
+        Trace(TraceOp::kGetMiss, handle);
+        return std::nullopt;
+      }
+      const Slot &slot = slots_[handle.index];
+      if (!IsChunkShared(slot.position)) {
+        SampleAccess(slot);
+        Trace(TraceOp::kGet, handle);
+        T &obj = *reinterpret_cast<T *>(&ItemAt(slot.position).storage);
+        return std::ref(obj);
+      }
+    }
 
+    rwlock::UniqueLock l(rwlock_);
     if (!IsValidInternal(handle)) {
+      HANDLE_POOL_PROBE3(get_miss, this, handle.index, handle.generation);
+      Trace(TraceOp::kGetMiss, handle);
       return std::nullopt;
     }
-    T &obj = *reinterpret_cast<T *>(&items_[handle.index].storage);
+    const Slot &slot = slots_[handle.index];
+    SampleAccess(slot);
+    Trace(TraceOp::kGet, handle);
+    T &obj = *reinterpret_cast<T *>(&MutableItemAt(slot.position).storage);
     return std::ref(obj);
   }
 
@@ -140,59 +471,1212 @@ public:
     rwlock::SharedLock l(rwlock_);
 
     if (!IsValidInternal(handle)) {
+      HANDLE_POOL_PROBE3(get_miss, this, handle.index, handle.generation);
+      Trace(TraceOp::kGetMiss, handle);
       return std::nullopt;
     }
-    const T &obj = *reinterpret_cast<const T *>(&items_[handle.index].storage);
+    const Slot &slot = slots_[handle.index];
+    SampleAccess(slot);
+    Trace(TraceOp::kGet, handle);
+    const T &obj = *reinterpret_cast<const T *>(&ItemAt(slot.position).storage);
     return std::cref(obj);
   }
 
   // Checks if a given handle is still valid.
-  bool IsValid(const Handle &handle) {
+  bool IsValid(const Handle &handle) const {
     rwlock::SharedLock l(rwlock_);
     return IsValidInternal(handle);
   }
 
-  inline constexpr size_t Capacity() const { return capacity_; }
+  // Current number of slots; lock-free.
+  size_t Capacity() const { return capacity_.load(std::memory_order_relaxed); }
+
+  // Upper bound for growth (equal to Capacity() for a fixed-size pool).
+  size_t MaxCapacity() const { return max_capacity_; }
+
+  // Slots added by each `Grow` of a growable pool.
+  static constexpr size_t ChunkCapacity() { return kItemsPerChunk; }
+
+  // Bytes of object storage added by each `Grow`.
+  static constexpr size_t ChunkBytes() { return kItemsPerChunk * sizeof(Item); }
+
+  // Bytes of object storage currently allocated; lock-free.
+  size_t StorageBytes() const { return Capacity() * sizeof(Item); }
+
+  // Reports the pool's memory footprint and how densely live objects fill
+  // the resident storage pages and cache lines (1.0 is perfectly dense). Low
+  // fractions suggest `Reorganize` followed by `Shrink`. Residency comes from
+  // mincore(2), so this costs a system call per chunk.
+  HandlePoolMemoryStats MemoryStats() const {
+    static constexpr size_t kCacheLine = 64;
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    rwlock::SharedLock l(rwlock_);
+
+    HandlePoolMemoryStats stats;
+    const size_t capacity = Capacity();
+    const size_t live = capacity - free_list_.size();
+    stats.reserved_bytes = capacity * sizeof(Item);
+    stats.live_bytes = live * sizeof(T);
+    stats.metadata_bytes =
+        capacity * (sizeof(Item) - sizeof(T)) +
+        slots_.capacity() * sizeof(Slot) +
+        free_list_.capacity() * sizeof(uint32_t) +
+        chunks_.capacity() * sizeof(std::shared_ptr<Chunk>) +
+        chunks_.size() * sizeof(Chunk) +
+        static_cast<size_t>(options_.max_tenants) * sizeof(Tenant);
+
+    size_t resident_pages = 0, live_pages = 0;
+    size_t resident_lines = 0, live_lines = 0;
+    for (const auto &chunk : chunks_) {
+      const uintptr_t begin = reinterpret_cast<uintptr_t>(chunk->items.get());
+      const uintptr_t end = begin + chunk->size * sizeof(Item);
+      const uintptr_t first_page = begin / page * page;
+      const size_t pages = (end - first_page + page - 1) / page;
+      std::vector<unsigned char> resident(pages);
+      if (mincore(reinterpret_cast<void *>(first_page), end - first_page,
+                  resident.data()) != 0) {
+        continue;
+      }
+      // Live bytes per page and per cache line of this chunk.
+      std::vector<bool> page_live(pages);
+      const uintptr_t first_line = begin / kCacheLine * kCacheLine;
+      std::vector<bool> line_live((end - first_line - 1) / kCacheLine + 1);
+      for (size_t i = 0; i < chunk->size; ++i) {
+        if (!chunk->items[i].in_use) {
+          continue;
+        }
+        const uintptr_t obj = begin + i * sizeof(Item);
+        for (uintptr_t a = obj; a < obj + sizeof(T);
+             a = (a / kCacheLine + 1) * kCacheLine) {
+          line_live[(a - first_line) / kCacheLine] = true;
+          page_live[(a - first_page) / page] = true;
+        }
+      }
+      for (size_t p = 0; p < pages; ++p) {
+        if (!(resident[p] & 1)) {
+          continue;
+        }
+        const uintptr_t lo = std::max(begin, first_page + p * page);
+        const uintptr_t hi = std::min(end, first_page + (p + 1) * page);
+        stats.committed_bytes += hi - lo;
+        ++resident_pages;
+        live_pages += page_live[p];
+        for (uintptr_t a = lo / kCacheLine * kCacheLine; a < hi;
+             a += kCacheLine) {
+          ++resident_lines;
+          live_lines += line_live[(a - first_line) / kCacheLine];
+        }
+      }
+    }
+    if (resident_pages > 0) {
+      stats.live_page_fraction =
+          static_cast<double>(live_pages) / resident_pages;
+      stats.live_cache_line_fraction =
+          static_cast<double>(live_lines) / resident_lines;
+    }
+    return stats;
+  }
+
+  // Touches every page of object storage and of the slot table and free
+  // list (reserved up to the maximum capacity, so growth does not
+  // reallocate them), so that later operations do not page-fault. Only free
+  // slots are written; live and reserved ones are left alone. Chunks added
+  // by later growth are not covered. Returns the number of bytes touched.
+  size_t Prefault() {
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    rwlock::UniqueLock l(rwlock_);
+
+    size_t touched = 0;
+    for (const auto &chunk : chunks_) {
+      for (size_t i = 0; i < chunk->size; ++i) {
+        Item &item = chunk->items[i];
+        // A reserved item may be under construction by another thread.
+        if (item.in_use || item.reserved) {
+          continue;
+        }
+        // Free storage holds no object, so zeroing a byte per page (and the
+        // last one) is harmless, even in a chunk shared with a clone.
+        volatile unsigned char *bytes =
+            reinterpret_cast<volatile unsigned char *>(&item);
+        for (size_t offset = 0; offset < sizeof(Item); offset += page) {
+          bytes[offset] = 0;
+        }
+        bytes[sizeof(Item) - 1] = 0;
+      }
+      touched += chunk->size * sizeof(Item);
+    }
+
+    // Growing into the spare capacity initializes, and so touches, it;
+    // shrinking back keeps the existing entries (and the capacity).
+    const size_t slot_count = slots_.size();
+    slots_.resize(std::max(slots_.capacity(), max_capacity_));
+    touched += slots_.size() * sizeof(Slot);
+    slots_.resize(slot_count);
+    const size_t free_count = free_list_.size();
+    free_list_.resize(std::max(free_list_.capacity(), max_capacity_));
+    touched += free_list_.size() * sizeof(uint32_t);
+    free_list_.resize(free_count);
+    return touched;
+  }
+
+  // Bytes of object storage locked into memory (see
+  // HandlePoolOptions::lock_memory).
+  size_t PinnedBytes() const {
+    rwlock::SharedLock l(rwlock_);
+
+    size_t pinned = 0;
+    for (const auto &chunk : chunks_) {
+      pinned += chunk->pinned ? chunk->size * sizeof(Item) : 0;
+    }
+    return pinned;
+  }
 
   // Returns true if there are no currently used slots.
-  bool Empty() {
+  bool Empty() const {
     rwlock::SharedLock l(rwlock_);
-    return (free_list_.size() == capacity_);
+    return (free_list_.size() == Capacity());
   }
 
   // Returns how many free slots remain.
-  size_t Free() {
+  size_t Free() const {
     rwlock::SharedLock l(rwlock_);
     return free_list_.size();
   }
 
+  // Starts (or, given nullptr, stops) recording Create, Destroy and Get calls
+  // into `trace`, which must outlive the recording. Clones do not record.
+  void SetTrace(OpTrace *trace) {
+    trace_.store(trace, std::memory_order_release);
+  }
+
+  // Installs (or, given nullptr, removes) the gate consulted before growth.
+  void SetGrowthGate(GrowthGate gate) {
+    rwlock::UniqueLock l(rwlock_);
+    growth_gate_ = std::move(gate);
+  }
+
+  // Adds ChunkCapacity() free slots, reusing parked handle indices first.
+  // Returns false if the pool is at its maximum capacity or the growth gate
+  // refused.
+  bool Grow() { return GrowImpl(std::numeric_limits<size_t>::max()); }
+
+  // Releases trailing chunks whose slots and positions are all free until at
+  // least `bytes` have been released, never going below the initial
+  // capacity. Returns the number of bytes released.
+  size_t Shrink(const size_t bytes = std::numeric_limits<size_t>::max()) {
+    rwlock::UniqueLock l(rwlock_);
+
+    size_t released = 0;
+    while (released < bytes) {
+      const size_t capacity = Capacity();
+      const size_t begin = capacity - chunks_.back()->size;
+      if (begin < min_capacity_ || !IsTailFree(begin, capacity) ||
+          free_list_.size() - (capacity - begin) < reserved_unused_) {
+        break;
+      }
+      // Hand the tail positions to the tail slots, so that the slots left
+      // active address only the remaining chunks. All of them are free.
+      std::vector<uint32_t> outside;
+      for (size_t i = begin; i < capacity; ++i) {
+        if (slots_[i].position < begin) {
+          outside.push_back(static_cast<uint32_t>(i));
+        }
+      }
+      for (uint32_t i = 0; i < begin && !outside.empty(); ++i) {
+        if (slots_[i].position >= begin) {
+          std::swap(slots_[i].position, slots_[outside.back()].position);
+          outside.pop_back();
+        }
+      }
+      free_list_.erase(std::remove_if(free_list_.begin(), free_list_.end(),
+                                      [&](const uint32_t i) {
+                                        return i >= begin;
+                                      }),
+                       free_list_.end());
+      released += chunks_.back()->size * sizeof(Item);
+      chunks_.pop_back();
+      capacity_.store(begin, std::memory_order_relaxed);
+    }
+    return released;
+  }
+
+  // Sets `tenant`'s quota. Returns false if the tenant is unknown, if
+  // `quota.reserved` exceeds `quota.max`, or if there are not enough free
+  // slots to back the reservation.
+  bool SetTenantQuota(const TenantId tenant, const TenantQuota &quota) {
+    if (tenant.value >= options_.max_tenants || quota.reserved > quota.max) {
+      return false;
+    }
+    rwlock::UniqueLock l(rwlock_);
+
+    Tenant &state = tenants_[tenant.value];
+    const size_t objects = state.objects.load(std::memory_order_relaxed);
+    const size_t before = UnusedReservation(state);
+    const size_t after =
+        quota.reserved > objects ? quota.reserved - objects : 0;
+    if (reserved_unused_ - before + after > free_list_.size()) {
+      return false;
+    }
+    state.reserved = quota.reserved;
+    state.max = quota.max;
+    reserved_unused_ = reserved_unused_ - before + after;
+    return true;
+  }
+
+  // Number of objects `tenant` currently holds; lock-free.
+  size_t TenantObjects(const TenantId tenant) const {
+    if (tenant.value >= options_.max_tenants) {
+      return 0;
+    }
+    return tenants_[tenant.value].objects.load(std::memory_order_relaxed);
+  }
+
+  // Relocates live objects so that the most frequently accessed ones (by
+  // sampled `Get` count) form a contiguous prefix of `items_`, followed by
+  // the colder live objects and then the free positions. Handles keep
+  // working; heat counters are halved so that old accesses decay. Returns the
+  // number of objects that changed position. Does nothing while objects are
+  // being constructed into reserved slots.
+  size_t Reorganize() {
+    static_assert(std::is_move_constructible_v<T>,
+                  "Reorganize() requires a move-constructible T");
+    rwlock::UniqueLock l(rwlock_);
+    if (reservations_ > 0) {
+      return 0;
+    }
+    UnshareChunks();
+    const size_t capacity = Capacity();
+
+    // Live slots hottest first, then free slots in their current order.
+    std::vector<uint32_t> order(capacity);
+    for (uint32_t i = 0; i < capacity; ++i) {
+      order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      const bool live_a = ItemAt(slots_[a].position).in_use;
+      const bool live_b = ItemAt(slots_[b].position).in_use;
+      if (live_a != live_b) {
+        return live_a;
+      }
+      return slots_[a].heat.load(std::memory_order_relaxed) >
+             slots_[b].heat.load(std::memory_order_relaxed);
+    });
+
+    std::vector<std::shared_ptr<Chunk>> reordered;
+    reordered.reserve(chunks_.size());
+    for (const auto &chunk : chunks_) {
+      reordered.push_back(MakeChunk(chunk->size));
+    }
+    size_t moved = 0;
+    for (uint32_t position = 0; position < capacity; ++position) {
+      Slot &slot = slots_[order[position]];
+      Item &from = MutableItemAt(slot.position);
+      if (from.in_use) {
+        Item &to = reordered[position / kItemsPerChunk]
+                       ->items[position % kItemsPerChunk];
+        T *obj = reinterpret_cast<T *>(&from.storage);
+        new (&to.storage) T(std::move(*obj));
+        obj->~T();
+        from.in_use = false;
+        to.in_use = true;
+      }
+      moved += (slot.position != position);
+      slot.position = position;
+      slot.heat.store(slot.heat.load(std::memory_order_relaxed) / 2,
+                      std::memory_order_relaxed);
+    }
+    chunks_.swap(reordered);
+    return moved;
+  }
+
+  // Moves every live object into an immutable FrozenHandlePool, densely
+  // packed in `items_` order, and leaves this pool empty. Handles issued so
+  // far resolve in the frozen pool and are stale here. Reserved slots are left
+  // to their PendingHandles.
+  FrozenHandlePool<T> Freeze() {
+    static_assert(std::is_move_constructible_v<T>,
+                  "Freeze() requires a move-constructible T");
+    rwlock::UniqueLock l(rwlock_);
+    UnshareChunks();
+    const size_t capacity = Capacity();
+
+    std::vector<uint32_t> slot_at(capacity);
+    for (uint32_t i = 0; i < capacity; ++i) {
+      slot_at[slots_[i].position] = i;
+    }
+
+    FrozenHandlePool<T> frozen;
+    frozen.entries_.resize(capacity);
+    frozen.values_.reserve(capacity - free_list_.size());
+    frozen.dense_slots_.reserve(capacity - free_list_.size());
+    for (uint32_t position = 0; position < capacity; ++position) {
+      const uint32_t i = slot_at[position];
+      Slot &slot = slots_[i];
+      Item &item = MutableItemAt(position);
+      frozen.entries_[i].generation = slot.generation;
+      if (item.reserved) {
+        // Stays reserved here; the frozen entry holds no object.
+        continue;
+      }
+      if (item.in_use) {
+        T *obj = reinterpret_cast<T *>(&item.storage);
+        frozen.entries_[i].dense =
+            static_cast<uint32_t>(frozen.values_.size());
+        frozen.values_.push_back(std::move(*obj));
+        frozen.dense_slots_.push_back(i);
+        obj->~T();
+        item.in_use = false;
+      }
+      // Every slot moves past the generation the frozen pool recorded for it,
+      // so neither pool can issue a handle the other would accept.
+      ++slot.generation;
+    }
+
+    free_list_.clear();
+    for (uint32_t i = 0; i < capacity; ++i) {
+      if (!ItemAt(slots_[i].position).reserved) {
+        free_list_.push_back(i);
+      }
+      slots_[i].tenant = kNoTenant;
+    }
+    reserved_unused_ = 0;
+    for (uint32_t t = 0; t < options_.max_tenants; ++t) {
+      tenants_[t].objects.store(0, std::memory_order_relaxed);
+      reserved_unused_ += tenants_[t].reserved;
+    }
+    return frozen;
+  }
+
+  // Returns a new pool holding the same objects under the same handles. The
+  // storage chunks are shared copy-on-write, so this costs O(capacity) slot
+  // metadata plus one refcount per chunk rather than a copy of every object.
+  // References obtained from `Get` before the clone must not be written
+  // through afterwards, since they may point into a now-shared chunk.
+  std::unique_ptr<HandlePool> Clone() {
+    static_assert(std::is_copy_constructible_v<T>,
+                  "Clone() requires a copy-constructible T");
+    rwlock::UniqueLock l(rwlock_);
+    return std::unique_ptr<HandlePool>(new HandlePool(*this, CloneTag{}));
+  }
+
+  // Writes the pool's objects and handles to `path` on a background thread.
+  // The pause is a `Clone` under the exclusive lock, which is not constant:
+  // it copies the slot table and free list, O(capacity) and a few tens of
+  // bytes per slot (4 to 10 ms per million slots), and blocks every other
+  // operation meanwhile. The clone's chunks are then written with large
+  // sequential writes while this pool keeps serving requests, copying a
+  // chunk only the first time it writes to one still being checkpointed.
+  // Only live objects are written; free items are zeroed. The file appears
+  // atomically (written under a temporary name, then renamed). The future
+  // yields false on I/O errors.
+  std::future<bool> CheckpointAsync(const std::string &path) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "CheckpointAsync() requires a trivially copyable T");
+    return std::async(std::launch::async,
+                      [snapshot = Clone(), path] {
+                        return snapshot->WriteCheckpoint(path);
+                      });
+  }
+
+  // Loads a pool written by `CheckpointAsync`, or returns nullptr if `path`
+  // is not a checkpoint of a pool of T. Handles issued by the checkpointed
+  // pool resolve in the restored one. `options` configures the restored pool;
+  // its initial capacity is raised to the checkpoint's. Tenants are not
+  // restored: objects come back without an owner.
+  static std::unique_ptr<HandlePool>
+  RestoreCheckpoint(const std::string &path, HandlePoolOptions options = {}) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "RestoreCheckpoint() requires a trivially copyable T");
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return nullptr;
+    }
+    std::unique_ptr<HandlePool> pool = ReadCheckpoint(fd, options);
+    close(fd);
+    return pool;
+  }
+
   // Disallow copy (owning resource).
   HandlePool(const HandlePool &) = delete;
   HandlePool &operator=(const HandlePool &) = delete;
 
 private:
+  friend class BatchExecutor<T>;
+  // Reads its private pools without their locks, under its own.
+  template <typename V, typename E> friend class HandleGraph;
+
+  // Object storage, addressed by position.
   struct Item {
     alignas(T) unsigned char storage[sizeof(T)];
-    uint32_t generation;
-    bool in_use;
+    bool in_use = false;
+    // Held by a PendingHandle; the storage may be under construction.
+    bool reserved = false;
+  };
+
+  // Per-handle-index metadata.
+  struct Slot {
+    uint32_t position = 0;
+    uint32_t generation = 0;
+    // Owner of the live object, or kNoTenant.
+    uint32_t tenant = kNoTenant;
+    // Sampled access count; bumped under the shared lock, hence atomic.
+    mutable std::atomic<uint32_t> heat{0};
+
+    Slot() = default;
+    Slot(const Slot &other)
+        : position(other.position), generation(other.generation),
+          tenant(other.tenant),
+          heat(other.heat.load(std::memory_order_relaxed)) {}
+  };
+
+  // Quota and usage of one tenant. `objects` changes under the exclusive
+  // lock but is read without it.
+  struct Tenant {
+    std::atomic<size_t> objects{0};
+    size_t reserved = 0;
+    size_t max = std::numeric_limits<size_t>::max();
+  };
+
+  static constexpr uint32_t kNoTenant = std::numeric_limits<uint32_t>::max();
+
+  // A run of consecutive items. Clones share chunks; the last owner destroys
+  // the live objects.
+  struct Chunk {
+    explicit Chunk(const size_t size) : size(size), items(new Item[size]) {}
+
+    Chunk(const Chunk &other) : Chunk(other.size) {
+      for (size_t i = 0; i < size; ++i) {
+        if (other.items[i].in_use) {
+          new (&items[i].storage)
+              T(*reinterpret_cast<const T *>(&other.items[i].storage));
+          items[i].in_use = true;
+        }
+      }
+    }
+
+    ~Chunk() {
+      for (size_t i = 0; i < size; ++i) {
+        if (items[i].in_use) {
+          reinterpret_cast<T *>(&items[i].storage)->~T();
+        }
+      }
+      if (pinned) {
+        munlock(items.get(), size * sizeof(Item));
+      }
+    }
+
+    const size_t size;
+    // Whether `items` is mlock'ed.
+    bool pinned = false;
+    // Reserved items. Such a chunk is never shared with a clone, so its
+    // storage stays put while objects are constructed into it.
+    size_t reservations = 0;
+    std::unique_ptr<Item[]> items;
+  };
+
+  static constexpr size_t FloorPowerOfTwo(const size_t n) {
+    size_t p = 1;
+    while (p <= n / 2) {
+      p *= 2;
+    }
+    return p;
+  }
+
+  // Items per chunk: a power of two, so that a chunk is at most ~64 KiB
+  // (but holds at least one item).
+  static constexpr size_t kItemsPerChunk =
+      FloorPowerOfTwo(std::max<size_t>(1, (64 * 1024) / sizeof(Item)));
+
+  // Allocates a chunk (empty, or a copy of `arg`), locking it into memory if
+  // the pool is configured to.
+  template <typename Arg> std::shared_ptr<Chunk> MakeChunk(const Arg &arg) {
+    auto chunk = std::make_shared<Chunk>(arg);
+    if (options_.lock_memory) {
+      chunk->pinned =
+          mlock(chunk->items.get(), chunk->size * sizeof(Item)) == 0;
+    }
+    return chunk;
+  }
+
+  // Calls fn(c) for every index c of chunks_, spread over
+  // options_.init_threads threads in contiguous runs.
+  template <typename Fn> void ParallelForChunks(const Fn &fn) {
+    const size_t count = chunks_.size();
+    const size_t threads = std::min(options_.init_threads, count);
+    if (threads <= 1) {
+      for (size_t c = 0; c < count; ++c) {
+        fn(c);
+      }
+      return;
+    }
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (size_t t = 0; t < threads; ++t) {
+      workers.emplace_back([&, t] {
+        if (options_.init_thread_setup) {
+          options_.init_thread_setup(t);
+        }
+        for (size_t c = count * t / threads; c < count * (t + 1) / threads;
+             ++c) {
+          fn(c);
+        }
+      });
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  static constexpr size_t RoundUpToChunk(const size_t n) {
+    return (n + kItemsPerChunk - 1) / kItemsPerChunk * kItemsPerChunk;
+  }
+
+  struct CloneTag {};
+
+  // Copies the metadata and shares the chunks of `other` (whose exclusive
+  // lock the caller holds). The clone has no growth gate and no
+  // reservations.
+  HandlePool(const HandlePool &other, CloneTag)
+      : options_(other.options_), min_capacity_(other.min_capacity_),
+        max_capacity_(other.max_capacity_),
+        capacity_(other.Capacity()), chunks_(other.chunks_),
+        slots_(other.slots_), tenants_(new Tenant[options_.max_tenants]),
+        reserved_unused_(other.reserved_unused_) {
+    free_list_.reserve(other.free_list_.capacity());
+    free_list_ = other.free_list_;
+    for (uint32_t t = 0; t < options_.max_tenants; ++t) {
+      tenants_[t].objects.store(
+          other.tenants_[t].objects.load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+      tenants_[t].reserved = other.tenants_[t].reserved;
+      tenants_[t].max = other.tenants_[t].max;
+    }
+    if (other.reservations_ == 0) {
+      return;
+    }
+    // Chunks with reservations are copied rather than shared, so that
+    // objects under construction in `other` stay where their owners write
+    // them. In the clone, reserved slots are free.
+    for (auto &chunk : chunks_) {
+      if (chunk->reservations > 0) {
+        chunk = MakeChunk(*chunk);
+      }
+    }
+    for (uint32_t i = 0; i < Capacity(); ++i) {
+      if (other.ItemAt(slots_[i].position).reserved) {
+        free_list_.push_back(i);
+      }
+    }
+  }
+
+  // Checkpoint file layout: this header, then (position, generation) for
+  // each of `slots` slots (the active ones, then those parked by `Shrink`),
+  // then the `capacity` Items in position order.
+  struct CheckpointHeader {
+    char magic[8];
+    uint64_t item_bytes;
+    uint64_t capacity;
+    uint64_t slots;
+  };
+  static constexpr char kCheckpointMagic[8] = {'H', 'P', 'C', 'K',
+                                               'P', 'T', '0', '2'};
+  // Chunks' worth of items staged for one writev call.
+  static constexpr size_t kCheckpointChunksPerWrite = 16;
+
+  // Writes this pool (a snapshot no one else modifies) to `path`.
+  bool WriteCheckpoint(const std::string &path) const {
+    rwlock::SharedLock l(rwlock_);
+    const size_t capacity = Capacity();
+
+    CheckpointHeader header;
+    std::memcpy(header.magic, kCheckpointMagic, sizeof(header.magic));
+    header.item_bytes = sizeof(Item);
+    header.capacity = capacity;
+    header.slots = slots_.size();
+    std::vector<uint32_t> slots(2 * slots_.size());
+    for (size_t i = 0; i < slots_.size(); ++i) {
+      slots[2 * i] = slots_[i].position;
+      slots[2 * i + 1] = slots_[i].generation;
+    }
+
+    const std::string temp_path = path + ".tmp";
+    const int fd =
+        open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    std::vector<iovec> iov;
+    iov.push_back({&header, sizeof(header)});
+    iov.push_back({slots.data(), slots.size() * sizeof(uint32_t)});
+    bool ok = WriteAll(fd, iov);
+    // Items are staged so that free ones, and the padding of live ones, are
+    // written as zeros rather than as stale bytes of destroyed objects.
+    std::vector<Item> staging(
+        std::min(capacity, kCheckpointChunksPerWrite * kItemsPerChunk));
+    size_t staged = 0;
+    for (uint32_t position = 0; ok && position < capacity; ++position) {
+      const Item &item = ItemAt(position);
+      Item &out = staging[staged++];
+      std::memset(static_cast<void *>(&out), 0, sizeof(Item));
+      if (item.in_use) {
+        std::memcpy(&out.storage, &item.storage, sizeof(T));
+        out.in_use = true;
+      }
+      if (staged == staging.size() || position + 1 == capacity) {
+        iov.push_back({staging.data(), staged * sizeof(Item)});
+        ok = WriteAll(fd, iov);
+        staged = 0;
+      }
+    }
+    ok = fsync(fd) == 0 && ok;
+    ok = close(fd) == 0 && ok;
+    if (!ok || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+      std::remove(temp_path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  // Writes out and clears `iov`, retrying partial writes.
+  static bool WriteAll(const int fd, std::vector<iovec> &iov) {
+    size_t first = 0;
+    while (first < iov.size()) {
+      const ssize_t written =
+          writev(fd, &iov[first], static_cast<int>(iov.size() - first));
+      if (written < 0) {
+        return false;
+      }
+      size_t left = static_cast<size_t>(written);
+      while (first < iov.size() && left >= iov[first].iov_len) {
+        left -= iov[first++].iov_len;
+      }
+      if (left > 0) {
+        iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + left;
+        iov[first].iov_len -= left;
+      }
+    }
+    iov.clear();
+    return true;
+  }
+
+  // Reads exactly `size` bytes, or returns false.
+  static bool ReadAll(const int fd, void *data, size_t size) {
+    char *out = static_cast<char *>(data);
+    while (size > 0) {
+      const ssize_t got = read(fd, out, size);
+      if (got <= 0) {
+        return false;
+      }
+      out += got;
+      size -= static_cast<size_t>(got);
+    }
+    return true;
+  }
+
+  static std::unique_ptr<HandlePool> ReadCheckpoint(const int fd,
+                                                    HandlePoolOptions options) {
+    CheckpointHeader header;
+    if (!ReadAll(fd, &header, sizeof(header)) ||
+        std::memcmp(header.magic, kCheckpointMagic, sizeof(header.magic)) !=
+            0 ||
+        header.item_bytes != sizeof(Item) || header.capacity == 0 ||
+        header.slots < header.capacity ||
+        header.slots > std::numeric_limits<uint32_t>::max()) {
+      return nullptr;
+    }
+    const size_t capacity = header.capacity;
+    const size_t slot_count = header.slots;
+    std::vector<uint32_t> slots(2 * slot_count);
+    if (!ReadAll(fd, slots.data(), slots.size() * sizeof(uint32_t))) {
+      return nullptr;
+    }
+    // Positions must be a permutation of [0, capacity).
+    std::vector<bool> seen(capacity);
+    for (size_t i = 0; i < capacity; ++i) {
+      const uint32_t position = slots[2 * i];
+      if (position >= capacity || seen[position]) {
+        return nullptr;
+      }
+      seen[position] = true;
+    }
+
+    options.initial_capacity = std::max(options.initial_capacity, capacity);
+    std::unique_ptr<HandlePool> pool(new HandlePool(options));
+    size_t remaining = capacity;
+    for (size_t c = 0; remaining > 0; ++c) {
+      Chunk &chunk = *pool->chunks_[c];
+      const size_t items = std::min(chunk.size, remaining);
+      // The flags must hold 0 or 1 before they are read as bools, and the
+      // file never holds reservations. T is trivially destructible, so on
+      // failure clearing the flags lets the pool be dropped.
+      const bool read = ReadAll(fd, chunk.items.get(), items * sizeof(Item));
+      bool flags_ok = read;
+      for (size_t i = 0; flags_ok && i < items; ++i) {
+        unsigned char in_use, reserved;
+        std::memcpy(&in_use, &chunk.items[i].in_use, 1);
+        std::memcpy(&reserved, &chunk.items[i].reserved, 1);
+        flags_ok = in_use <= 1 && reserved == 0;
+      }
+      if (!flags_ok) {
+        for (size_t i = 0; i < items; ++i) {
+          chunk.items[i].in_use = false;
+          chunk.items[i].reserved = false;
+        }
+        return nullptr;
+      }
+      remaining -= items;
+    }
+
+    // Parked slots keep their generations, so that handles into them stay
+    // stale when the restored pool grows. They are all free, so each can
+    // take its own index as its position.
+    if (pool->slots_.size() < slot_count) {
+      pool->slots_.resize(slot_count);
+    }
+    pool->free_list_.clear();
+    for (size_t i = 0; i < pool->slots_.size(); ++i) {
+      Slot &slot = pool->slots_[i];
+      if (i < slot_count) {
+        slot.position =
+            i < capacity ? slots[2 * i] : static_cast<uint32_t>(i);
+        slot.generation = slots[2 * i + 1];
+      }
+      if (i < pool->Capacity() && !pool->ItemAt(slot.position).in_use) {
+        pool->free_list_.push_back(static_cast<uint32_t>(i));
+      }
+    }
+    return pool;
+  }
+
+  // Pool resizing decided under the lock and applied after it is released.
+  struct Sizing {
+    size_t grow_chunks = 0;
+    size_t shrink_bytes = 0;
   };
 
+  template <typename... Args>
+  const Handle CreateInternal(Sizing &sizing, const uint32_t tenant,
+                              Args &&...args) {
+    // Free slots needed: one plus the reservations of everyone else.
+    size_t needed = 1;
+    do {
+      rwlock::UniqueLock l(rwlock_);
+
+      needed = 1 + reserved_unused_;
+      if (tenant != kNoTenant) {
+        const Tenant &state = tenants_[tenant];
+        if (state.objects.load(std::memory_order_relaxed) >= state.max) {
+          return Handle::Invalid();
+        }
+        needed -= UnusedReservation(state);
+      }
+      if (free_list_.size() < needed) {
+        continue;
+      }
+      const uint32_t slot = free_list_.back();
+      free_list_.pop_back();
+
+      Item &item = MutableItemAt(slots_[slot].position);
+      try {
+        new (&item.storage) T(std::forward<Args>(args)...);
+        item.in_use = true;
+      } catch (...) {
+        // If constructor throws, put the slot back.
+        free_list_.push_back(slot);
+        return Handle::Invalid();
+      }
+
+      slots_[slot].heat.store(0, std::memory_order_relaxed);
+      slots_[slot].tenant = tenant;
+      if (tenant != kNoTenant) {
+        AddTenantObjects(tenant, 1);
+      }
+      sizing = RecordOccupancy();
+      HANDLE_POOL_PROBE3(create, this, slot, slots_[slot].generation);
+      const Handle handle{slot, slots_[slot].generation};
+      Trace(TraceOp::kCreate, handle);
+      return handle;
+    } while (GrowImpl(needed));
+    HANDLE_POOL_PROBE2(pool_full, this, Capacity());
+    return Handle::Invalid();
+  }
+
+  PendingHandle<T> ReserveInternal(Sizing &sizing) {
+    size_t needed = 1;
+    do {
+      rwlock::UniqueLock l(rwlock_);
+
+      needed = 1 + reserved_unused_;
+      if (free_list_.size() < needed) {
+        continue;
+      }
+      const uint32_t slot = free_list_.back();
+      free_list_.pop_back();
+
+      // Unshares the chunk, which then stays unshared until the reservation
+      // ends (see `CloneTag` constructor).
+      Item &item = MutableItemAt(slots_[slot].position);
+      item.reserved = true;
+      ++chunks_[slots_[slot].position / kItemsPerChunk]->reservations;
+      ++reservations_;
+      slots_[slot].heat.store(0, std::memory_order_relaxed);
+      slots_[slot].tenant = kNoTenant;
+      sizing = RecordOccupancy();
+      return PendingHandle<T>(this, Handle{slot, slots_[slot].generation},
+                              &item.storage);
+    } while (GrowImpl(needed));
+    HANDLE_POOL_PROBE2(pool_full, this, Capacity());
+    return PendingHandle<T>();
+  }
+
+  // Checks that `pending` holds a reservation of this pool (lock held).
+  bool IsReservation(const PendingHandle<T> &pending) const {
+    if (!pending.IsReserved()) {
+      return false;
+    }
+    const Handle handle = pending.handle();
+    if (handle.index >= Capacity() ||
+        slots_[handle.index].generation != handle.generation) {
+      return false;
+    }
+    const Item &item = ItemAt(slots_[handle.index].position);
+    return item.reserved && pending.storage_ == &item.storage;
+  }
+
+  // A reserved item, without copy-on-write: its chunk is never shared.
+  Item &ReservedItemAt(const uint32_t position) {
+    return chunks_[position / kItemsPerChunk]->items[position % kItemsPerChunk];
+  }
+
+  // Drops the reservation counts of a slot (exclusive lock held).
+  void EndReservation(const uint32_t index) {
+    --chunks_[slots_[index].position / kItemsPerChunk]->reservations;
+    --reservations_;
+  }
+
+  static size_t UnusedReservation(const Tenant &tenant) {
+    const size_t objects = tenant.objects.load(std::memory_order_relaxed);
+    return tenant.reserved > objects ? tenant.reserved - objects : 0;
+  }
+
+  // Adjusts a tenant's object count and the total unused reservation
+  // (exclusive lock held).
+  void AddTenantObjects(const uint32_t tenant, const int delta) {
+    Tenant &state = tenants_[tenant];
+    reserved_unused_ -= UnusedReservation(state);
+    state.objects.fetch_add(static_cast<size_t>(delta),
+                            std::memory_order_relaxed);
+    reserved_unused_ += UnusedReservation(state);
+  }
+
+  // Destroys the object if the handle is valid (exclusive lock held).
+  bool DestroyInternal(const Handle &handle, Sizing &sizing) {
+    if (!IsValidInternal(handle)) {
+      return false;
+    }
+
+    Slot &slot = slots_[handle.index];
+    Item &item = MutableItemAt(slot.position);
+    reinterpret_cast<T *>(&item.storage)->~T();
+    item.in_use = false;
+    ++slot.generation;
+    free_list_.push_back(handle.index);
+    HANDLE_POOL_PROBE3(destroy, this, handle.index, handle.generation);
+    Trace(TraceOp::kDestroy, handle);
+    if (slot.tenant != kNoTenant) {
+      AddTenantObjects(slot.tenant, -1);
+      slot.tenant = kNoTenant;
+    }
+    sizing = RecordOccupancy();
+    return true;
+  }
+
+  // Updates the occupancy window after a `Create` or `Destroy` and decides
+  // whether an auto-sized pool should resize (exclusive lock held).
+  Sizing RecordOccupancy() {
+    Sizing sizing;
+    if (!options_.auto_size || min_capacity_ == max_capacity_) {
+      return sizing;
+    }
+    const size_t capacity = Capacity();
+    const size_t live = capacity - free_list_.size();
+    window_high_water_ = std::max(window_high_water_, live);
+    if (++window_ops_ >= options_.window_ops) {
+      if (window_high_water_ < capacity * options_.shrink_occupancy) {
+        streak_high_water_ = std::max(streak_high_water_, window_high_water_);
+        ++low_windows_;
+      } else {
+        streak_high_water_ = 0;
+        low_windows_ = 0;
+      }
+      window_ops_ = 0;
+      window_high_water_ = live;
+    }
+    if (resizing_) {
+      return sizing;
+    }
+
+    const size_t available =
+        free_list_.size() - std::min(free_list_.size(), reserved_unused_);
+    if (capacity < max_capacity_ &&
+        available < capacity * options_.grow_headroom) {
+      sizing.grow_chunks = std::max<size_t>(
+          1, static_cast<size_t>(capacity * options_.growth_factor) /
+                 kItemsPerChunk);
+    } else if (low_windows_ >= options_.shrink_windows) {
+      const size_t target =
+          std::max(min_capacity_, RoundUpToChunk(2 * streak_high_water_));
+      if (target < capacity) {
+        sizing.shrink_bytes = (capacity - target) * sizeof(Item);
+      }
+      streak_high_water_ = 0;
+      low_windows_ = 0;
+    }
+    resizing_ = sizing.grow_chunks > 0 || sizing.shrink_bytes > 0;
+    return sizing;
+  }
+
+  // Carries out a resize decided by RecordOccupancy (no lock held).
+  void ApplySizing(const Sizing &sizing) {
+    if (sizing.grow_chunks == 0 && sizing.shrink_bytes == 0) {
+      return;
+    }
+    for (size_t i = 0; i < sizing.grow_chunks; ++i) {
+      if (!Grow()) {
+        break;
+      }
+    }
+    if (sizing.shrink_bytes > 0) {
+      Shrink(sizing.shrink_bytes);
+    }
+    rwlock::UniqueLock l(rwlock_);
+    resizing_ = false;
+  }
+
+  // `Grow`, except that it succeeds without growing if another thread has
+  // made `enough_free` slots free in the meantime (for `Create`).
+  bool GrowImpl(const size_t enough_free) {
+    GrowthGate gate;
+    {
+      rwlock::SharedLock l(rwlock_);
+      if (Capacity() >= max_capacity_) {
+        return false;
+      }
+      gate = growth_gate_;
+    }
+    const std::function<bool()> grow = [this, enough_free] {
+      rwlock::UniqueLock l(rwlock_);
+      return free_list_.size() >= enough_free || GrowInternal();
+    };
+    return gate ? gate(ChunkBytes(), grow) : grow();
+  }
+
+  // Appends a chunk of free slots (exclusive lock held).
+  bool GrowInternal() {
+    const size_t begin = Capacity();
+    if (begin >= max_capacity_) {
+      return false;
+    }
+    const size_t end = begin + kItemsPerChunk;
+    chunks_.push_back(MakeChunk(kItemsPerChunk));
+    // Sized once for the largest pool, so that `Destroy` never reallocates
+    // the free list.
+    free_list_.reserve(max_capacity_);
+    // Parked slots [begin, slots_.size()) keep their generations and already
+    // hold a permutation of the new positions (see `Shrink`).
+    for (size_t i = slots_.size(); i < end; ++i) {
+      slots_.emplace_back();
+      slots_.back().position = static_cast<uint32_t>(i);
+    }
+    for (size_t i = begin; i < end; ++i) {
+      free_list_.push_back(static_cast<uint32_t>(i));
+    }
+    capacity_.store(end, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Returns true if slots and positions [begin, end) are all free (callers
+  // must hold a lock).
+  bool IsTailFree(const size_t begin, const size_t end) const {
+    for (size_t i = begin; i < end; ++i) {
+      const Item &at_position = ItemAt(static_cast<uint32_t>(i));
+      const Item &of_slot = ItemAt(slots_[i].position);
+      if (at_position.in_use || at_position.reserved || of_slot.in_use ||
+          of_slot.reserved) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const Item &ItemAt(const uint32_t position) const {
+    return chunks_[position / kItemsPerChunk]->items[position % kItemsPerChunk];
+  }
+
+  // Callers must have checked that the chunk is not shared.
+  Item &ItemAt(const uint32_t position) {
+    return chunks_[position / kItemsPerChunk]->items[position % kItemsPerChunk];
+  }
+
+  // Returns true if a clone also holds the chunk containing `position`
+  // (callers must hold a lock).
+  bool IsChunkShared(const uint32_t position) const {
+    if (chunks_[position / kItemsPerChunk].use_count() > 1) {
+      return true;
+    }
+    // Pairs with the release decrement of the clone that dropped the chunk,
+    // so its last reads happen before our writes.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return false;
+  }
+
+  // Returns the item for writing, first copying its chunk if a clone shares
+  // it (callers must hold the exclusive lock).
+  Item &MutableItemAt(const uint32_t position) {
+    std::shared_ptr<Chunk> &chunk = chunks_[position / kItemsPerChunk];
+    if constexpr (std::is_copy_constructible_v<T>) {
+      if (IsChunkShared(position)) {
+        chunk = MakeChunk(*chunk);
+      }
+    }
+    return chunk->items[position % kItemsPerChunk];
+  }
+
+  // Copies every chunk still shared with a clone (exclusive lock held).
+  void UnshareChunks() {
+    for (size_t c = 0; c < chunks_.size(); ++c) {
+      MutableItemAt(static_cast<uint32_t>(c * kItemsPerChunk));
+    }
+  }
+
+  // Appends to the attached OpTrace, if any.
+  void Trace(const TraceOp op, const Handle &handle) const {
+    if (OpTrace *trace = trace_.load(std::memory_order_acquire)) {
+      trace->Record(op, handle.index, handle.generation);
+    }
+  }
+
+  // Bumps the slot's heat counter on one in kHeatSampleInterval calls.
+  static void SampleAccess(const Slot &slot) {
+    static thread_local uint32_t tick = 0;
+    if ((++tick % kHeatSampleInterval) == 0) {
+      slot.heat.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
   // Checks validity without locking (callers must hold a lock).
   const bool IsValidInternal(const Handle &handle) const {
-    if (handle.index >= capacity_ || handle == Handle::Invalid()) {
+    if (handle.index >= Capacity() || handle == Handle::Invalid()) {
       return false;
     }
-    const Item &item = items_[handle.index];
-    return item.in_use && (item.generation == handle.generation);
+    const Slot &slot = slots_[handle.index];
+    return (slot.generation == handle.generation) &&
+           ItemAt(slot.position).in_use;
   }
 
-  const size_t capacity_{0};
+  const HandlePoolOptions options_;
+  const size_t min_capacity_{0};
+  const size_t max_capacity_{0};
+  // Active slots; written under the exclusive lock, read anywhere.
+  std::atomic<size_t> capacity_{0};
 
-  std::vector<Item> items_;
+  // items_, split into chunks of kItemsPerChunk.
+  std::vector<std::shared_ptr<Chunk>> chunks_;
+  // Active slots followed by those parked by `Shrink`.
+  std::vector<Slot> slots_;
   std::vector<uint32_t> free_list_;
+  GrowthGate growth_gate_;
+
+  std::unique_ptr<Tenant[]> tenants_;
+  // Sum over tenants of reserved slots they do not use yet.
+  size_t reserved_unused_{0};
+
+  // Occupancy tracking for auto_size.
+  size_t window_ops_{0};
+  size_t window_high_water_{0};
+  size_t low_windows_{0};
+  size_t streak_high_water_{0};
+  bool resizing_{false};
+
+  // Attached recorder, or nullptr.
+  std::atomic<OpTrace *> trace_{nullptr};
+
+  // Outstanding PendingHandles.
+  size_t reservations_{0};
+
+  // Protect all shared data (chunks_, slots_, free_list_, growth_gate_, the
+  // tenant quotas and the occupancy tracking).
+  mutable rwlock::RWLock rwlock_;
+};
+
+/*
+ * An immutable, read-only snapshot of a HandlePool, produced by
+ * `HandlePool::Freeze`. Live objects are stored densely and lookups take no
+ * lock: each slot records the generation it was frozen at, and a slot that
+ * was free records a generation that no pool has issued, so a lookup only
+ * compares generations.
+ *
+ * Thread-safety: all methods are const and safe to call concurrently.
+ */
+template <typename T> class FrozenHandlePool {
+public:
+  FrozenHandlePool(FrozenHandlePool &&) = default;
+  FrozenHandlePool &operator=(FrozenHandlePool &&) = default;
+
+  // Returns an optional reference to const T if valid, else nullopt.
+  std::optional<std::reference_wrapper<const T>>
+  Get(const Handle &handle) const {
+    if (!IsValid(handle)) {
+      return std::nullopt;
+    }
+    return std::cref(values_[entries_[handle.index].dense]);
+  }
+
+  // Checks if a given handle refers to a frozen object.
+  bool IsValid(const Handle &handle) const {
+    return handle.index < entries_.size() &&
+           entries_[handle.index].generation == handle.generation &&
+           entries_[handle.index].dense != kNoObject;
+  }
+
+  // Number of slots of the pool this was frozen from.
+  size_t Capacity() const { return entries_.size(); }
+
+  // Number of frozen objects.
+  size_t Size() const { return values_.size(); }
+
+  // Calls fn(const Handle &, const T &) for every object, in storage order.
+  template <typename Fn> void ForEach(Fn &&fn) const {
+    for (size_t i = 0; i < values_.size(); ++i) {
+      const uint32_t slot = dense_slots_[i];
+      fn(Handle{slot, entries_[slot].generation}, values_[i]);
+    }
+  }
+
+  // Dense iteration over the frozen objects, in storage order.
+  typename std::vector<T>::const_iterator begin() const {
+    return values_.begin();
+  }
+  typename std::vector<T>::const_iterator end() const { return values_.end(); }
+
+private:
+  friend class HandlePool<T>;
+
+  // Entry::dense of a slot that held no object (free or reserved).
+  static constexpr uint32_t kNoObject = std::numeric_limits<uint32_t>::max();
+
+  struct Entry {
+    uint32_t generation = 0;
+    uint32_t dense = kNoObject;
+  };
+
+  FrozenHandlePool() = default;
 
-  // Protect all shared data (items_ and free_list_).
-  rwlock::RWLock rwlock_;
+  // Per-slot generation and index into values_.
+  std::vector<Entry> entries_;
+  std::vector<T> values_;
+  // Dense index -> slot, for ForEach.
+  std::vector<uint32_t> dense_slots_;
 };
 
 } // namespace handle_pool
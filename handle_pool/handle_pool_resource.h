@@ -0,0 +1,204 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+
+#include "handle_pool/handle_pool.h"
+
+namespace handle_pool {
+
+/*
+ * A std::pmr::memory_resource that serves fixed-size blocks from one
+ * preallocated slab, for the nodes of std::map, std::list,
+ * std::unordered_map and friends.
+ *
+ * Free blocks form a lock-free stack. Its head is a packed `Handle` whose
+ * index is the top block and whose generation is bumped on every push and
+ * pop, which defeats ABA the same way handle generations defeat stale
+ * handles.
+ *
+ * Requests larger than the block size, with stricter alignment, or made while
+ * the slab is exhausted are passed to the upstream resource.
+ *
+ * This is not built on HandlePool, whose slot machinery does not fit an
+ * allocator:
+ * - `deallocate` receives only a pointer. A block's index follows from its
+ *   address, so no slot table or generation check is needed.
+ * - HandlePool's free list is guarded by its exclusive lock. Every node
+ *   allocation and release would serialize on it, where a CAS suffices.
+ * - Blocks must never move, whereas `Reorganize` and copy-on-write chunks
+ *   may move a HandlePool's objects.
+ * The Handle encoding is reused, as the stack's ABA tag.
+ *
+ * Thread-safety: allocate and deallocate may be called concurrently.
+ */
+class HandlePoolResource : public std::pmr::memory_resource {
+public:
+  HandlePoolResource(const size_t block_size, const size_t block_count,
+                     std::pmr::memory_resource *upstream =
+                         std::pmr::get_default_resource())
+      : block_size_(RoundUp(block_size, kBlockAlignment)),
+        block_count_(block_count), upstream_(upstream) {
+    assert(block_size > 0);
+    assert(block_count_ > 0 && block_count_ < kEmpty);
+    slab_ = static_cast<std::byte *>(
+        upstream_->allocate(block_size_ * block_count_, kBlockAlignment));
+    next_.reset(new std::atomic<uint32_t>[block_count_]);
+    for (uint32_t i = 0; i < block_count_; ++i) {
+      next_[i].store(i + 1 < block_count_ ? i + 1 : kEmpty,
+                     std::memory_order_relaxed);
+    }
+    head_.store(Handle(0, 0).Pack(), std::memory_order_release);
+    free_blocks_.store(block_count_, std::memory_order_relaxed);
+  }
+
+  // All blocks must have been returned.
+  ~HandlePoolResource() override {
+    upstream_->deallocate(slab_, block_size_ * block_count_, kBlockAlignment);
+  }
+
+  size_t BlockSize() const { return block_size_; }
+
+  size_t BlockCount() const { return block_count_; }
+
+  // Returns how many slab blocks are currently free (a snapshot).
+  size_t FreeBlocks() const {
+    return free_blocks_.load(std::memory_order_relaxed);
+  }
+
+  // Returns how many requests were passed to the upstream resource.
+  size_t UpstreamAllocations() const {
+    return upstream_allocations_.load(std::memory_order_relaxed);
+  }
+
+  std::pmr::memory_resource *upstream_resource() const { return upstream_; }
+
+  // Disallow copy (owning resource).
+  HandlePoolResource(const HandlePoolResource &) = delete;
+  HandlePoolResource &operator=(const HandlePoolResource &) = delete;
+
+protected:
+  void *do_allocate(const size_t bytes, const size_t alignment) override {
+    if (bytes <= block_size_ && alignment <= kBlockAlignment) {
+      if (void *block = Pop()) {
+        return block;
+      }
+    }
+    upstream_allocations_.fetch_add(1, std::memory_order_relaxed);
+    return upstream_->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void *p, const size_t bytes,
+                     const size_t alignment) override {
+    std::byte *block = static_cast<std::byte *>(p);
+    if (block >= slab_ && block < slab_ + block_size_ * block_count_) {
+      Push(static_cast<uint32_t>((block - slab_) / block_size_));
+      return;
+    }
+    upstream_->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+
+private:
+  static constexpr size_t kBlockAlignment = alignof(std::max_align_t);
+  static constexpr uint32_t kEmpty = std::numeric_limits<uint32_t>::max();
+
+  static constexpr size_t RoundUp(const size_t n, const size_t to) {
+    return (n + to - 1) / to * to;
+  }
+
+  void *Pop() {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    for (;;) {
+      const Handle top = Handle::Unpack(head);
+      if (top.index == kEmpty) {
+        return nullptr;
+      }
+      const uint32_t next = next_[top.index].load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(head,
+                                      Handle(next, top.generation + 1).Pack(),
+                                      std::memory_order_acq_rel,
+                                      std::memory_order_acquire)) {
+        free_blocks_.fetch_sub(1, std::memory_order_relaxed);
+        return slab_ + static_cast<size_t>(top.index) * block_size_;
+      }
+    }
+  }
+
+  void Push(const uint32_t index) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      const Handle top = Handle::Unpack(head);
+      next_[index].store(top.index, std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(head,
+                                      Handle(index, top.generation + 1).Pack(),
+                                      std::memory_order_release,
+                                      std::memory_order_relaxed)) {
+        free_blocks_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+    }
+  }
+
+  const size_t block_size_;
+  const size_t block_count_;
+  std::pmr::memory_resource *const upstream_;
+
+  std::byte *slab_{nullptr};
+  // Block -> next free block (kEmpty terminates the stack).
+  std::unique_ptr<std::atomic<uint32_t>[]> next_;
+  // Packed Handle{top block, ABA tag}; on its own cache line.
+  alignas(64) std::atomic<uint64_t> head_{0};
+  alignas(64) std::atomic<size_t> free_blocks_{0};
+  std::atomic<size_t> upstream_allocations_{0};
+};
+
+/*
+ * A classic (non-polymorphic) allocator over a HandlePoolResource, for
+ * containers that take an allocator template argument.
+ */
+template <typename T> class HandlePoolAllocator {
+public:
+  using value_type = T;
+
+  explicit HandlePoolAllocator(HandlePoolResource *resource) noexcept
+      : resource_(resource) {}
+
+  template <typename U>
+  HandlePoolAllocator(const HandlePoolAllocator<U> &other) noexcept
+      : resource_(other.resource()) {}
+
+  T *allocate(const size_t n) {
+    return static_cast<T *>(resource_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *p, const size_t n) {
+    resource_->deallocate(p, n * sizeof(T), alignof(T));
+  }
+
+  HandlePoolResource *resource() const { return resource_; }
+
+  template <typename U>
+  bool operator==(const HandlePoolAllocator<U> &other) const {
+    return resource_ == other.resource();
+  }
+
+  template <typename U>
+  bool operator!=(const HandlePoolAllocator<U> &other) const {
+    return !(*this == other);
+  }
+
+private:
+  HandlePoolResource *resource_;
+};
+
+} // namespace handle_pool
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <utility>
+
+#include "handle_pool/handle_pool.h"
+
+namespace handle_pool {
+
+/*
+ * A bump allocator over a fixed byte area, handed to a pooled object for its
+ * internal allocations (small strings, short vectors, ...).
+ *
+ * Allocations are carved from the area in order; freeing the most recent one
+ * rolls the bump pointer back, which keeps a growing vector in place, while
+ * other frees are no-ops until the arena itself goes away. Requests that do
+ * not fit go to the upstream resource and are freed there individually.
+ */
+class SlotArena : public std::pmr::memory_resource {
+public:
+  SlotArena(std::byte *buffer, const size_t size,
+            std::pmr::memory_resource *upstream =
+                std::pmr::new_delete_resource())
+      : begin_(buffer), end_(buffer + size), top_(buffer), upstream_(upstream) {
+  }
+
+  // Bytes of the inline area currently in use.
+  size_t InlineBytesUsed() const { return static_cast<size_t>(top_ - begin_); }
+
+  // Allocations that did not fit inline and went upstream.
+  size_t OverflowAllocations() const { return overflow_allocations_; }
+
+  SlotArena(const SlotArena &) = delete;
+  SlotArena &operator=(const SlotArena &) = delete;
+
+protected:
+  void *do_allocate(const size_t bytes, const size_t alignment) override {
+    void *p = top_;
+    size_t space = static_cast<size_t>(end_ - top_);
+    if (std::align(alignment, bytes, p, space) != nullptr) {
+      last_ = static_cast<std::byte *>(p);
+      top_ = last_ + bytes;
+      return p;
+    }
+    ++overflow_allocations_;
+    return upstream_->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void *p, const size_t bytes,
+                     const size_t alignment) override {
+    std::byte *block = static_cast<std::byte *>(p);
+    if (block < begin_ || block >= end_) {
+      upstream_->deallocate(p, bytes, alignment);
+      return;
+    }
+    if (block == last_ && block + bytes == top_) {
+      top_ = last_;
+    }
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+
+private:
+  std::byte *const begin_;
+  std::byte *const end_;
+  // Next free byte and start of the most recent inline allocation.
+  std::byte *top_;
+  std::byte *last_{nullptr};
+  std::pmr::memory_resource *const upstream_;
+  size_t overflow_allocations_{0};
+};
+
+/*
+ * A HandlePool whose slots each reserve `ArenaBytes` beyond `sizeof(T)` for
+ * T's own allocations. T is constructed as `T(args..., resource)`, where
+ * `resource` is a `std::pmr::memory_resource *` over the slot's arena (the
+ * trailing-allocator convention of the std::pmr containers), so small
+ * strings and vectors inside pooled objects live in the slot itself.
+ * Destroying the object releases its arena with it.
+ *
+ * Objects are pinned to their slot (their arena points into it), so
+ * `Reorganize`, `Freeze` and `Clone` are not offered.
+ *
+ * Thread-safety: as for HandlePool.
+ */
+template <typename T, size_t ArenaBytes> class InlineArenaHandlePool {
+  static_assert(ArenaBytes > 0, "use HandlePool<T> for slots without an arena");
+
+public:
+  // Usage of one slot's arena.
+  struct ArenaStats {
+    size_t inline_bytes;
+    size_t overflow_allocations;
+  };
+
+  explicit InlineArenaHandlePool(const size_t capacity) : pool_(capacity) {}
+
+  // Creates T(args..., arena) in place, returning a handle.
+  template <typename... Args> const Handle Create(Args &&...args) {
+    return pool_.Create(std::forward<Args>(args)...);
+  }
+
+  // Destroy the T associated with the handle and release its arena.
+  bool Destroy(const Handle &handle) { return pool_.Destroy(handle); }
+
+  // Returns an optional reference to T if the handle is valid, else nullopt.
+  std::optional<std::reference_wrapper<T>> Get(const Handle &handle) {
+    auto slot = pool_.Get(handle);
+    if (!slot.has_value()) {
+      return std::nullopt;
+    }
+    return std::ref(slot.value().get().value);
+  }
+
+  // Const version. Returns an optional reference to const T if valid, else
+  // nullopt.
+  std::optional<std::reference_wrapper<const T>>
+  Get(const Handle &handle) const {
+    auto slot = pool_.Get(handle);
+    if (!slot.has_value()) {
+      return std::nullopt;
+    }
+    return std::cref(slot.value().get().value);
+  }
+
+  // Returns how much of the slot's arena the object uses, else nullopt.
+  std::optional<ArenaStats> Stats(const Handle &handle) const {
+    auto slot = pool_.Get(handle);
+    if (!slot.has_value()) {
+      return std::nullopt;
+    }
+    const SlotArena &arena = slot.value().get().arena;
+    return ArenaStats{arena.InlineBytesUsed(), arena.OverflowAllocations()};
+  }
+
+  // Checks if a given handle is still valid.
+  bool IsValid(const Handle &handle) { return pool_.IsValid(handle); }
+
+  inline constexpr size_t Capacity() const { return pool_.Capacity(); }
+
+  // Returns true if there are no currently used slots.
+  bool Empty() { return pool_.Empty(); }
+
+  // Returns how many free slots remain.
+  size_t Free() { return pool_.Free(); }
+
+private:
+  struct Slot {
+    template <typename... Args>
+    explicit Slot(Args &&...args)
+        : arena(buffer, ArenaBytes),
+          value(std::forward<Args>(args)...,
+                static_cast<std::pmr::memory_resource *>(&arena)) {}
+
+    Slot(const Slot &) = delete;
+    Slot &operator=(const Slot &) = delete;
+
+    // Declared before `value` so it outlives the object that allocates from
+    // it.
+    alignas(std::max_align_t) std::byte buffer[ArenaBytes];
+    SlotArena arena;
+    T value;
+  };
+
+  HandlePool<Slot> pool_;
+};
+
+} // namespace handle_pool
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace handle_pool {
+
+// Pool operations an OpTrace records.
+enum class TraceOp : uint8_t {
+  kCreate = 0,
+  kDestroy = 1,
+  kGet = 2,
+  // Get with a stale or invalid handle.
+  kGetMiss = 3,
+};
+
+// Number of TraceOp values.
+inline constexpr size_t kTraceOpCount = 4;
+
+// One recorded operation. The handle is stored as its raw fields so that the
+// trace format does not depend on the pool.
+struct TraceRecord {
+  // Nanoseconds since the trace started.
+  uint64_t timestamp_ns;
+  uint32_t index;
+  uint32_t generation;
+  // Small per-process id of the calling thread.
+  uint32_t thread;
+  TraceOp op;
+  // Zero, so saved traces carry no uninitialized bytes.
+  uint8_t reserved[3]{};
+};
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord is a file format");
+
+/*
+ * A fixed-size buffer of TraceRecords that a HandlePool appends to (see
+ * `HandlePool::SetTrace`), for capturing production access patterns and
+ * replaying them with benchmarks/replay_trace.
+ *
+ * Recording claims a record with one atomic increment and never allocates;
+ * operations beyond the buffer's capacity are counted and dropped.
+ *
+ * Traces are saved as an 8-byte magic, a 64-bit record count and the
+ * records, in host byte order.
+ *
+ * Thread-safety: `Record` may be called concurrently. Read the records
+ * (`Records`, `WriteFile`) only once recording has stopped.
+ */
+class OpTrace {
+public:
+  explicit OpTrace(const size_t max_records)
+      : capacity_(max_records), records_(new TraceRecord[max_records]),
+        start_(std::chrono::steady_clock::now()) {}
+
+  void Record(const TraceOp op, const uint32_t index,
+              const uint32_t generation) {
+    const size_t i = next_.fetch_add(1, std::memory_order_relaxed);
+    if (i >= capacity_) {
+      return;
+    }
+    TraceRecord &record = records_[i];
+    record.timestamp_ns = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_)
+            .count());
+    record.index = index;
+    record.generation = generation;
+    record.thread = ThreadId();
+    record.op = op;
+  }
+
+  // Number of records kept.
+  size_t Size() const {
+    return std::min(next_.load(std::memory_order_relaxed), capacity_);
+  }
+
+  // Number of operations dropped because the buffer was full.
+  size_t Dropped() const {
+    const size_t next = next_.load(std::memory_order_relaxed);
+    return next > capacity_ ? next - capacity_ : 0;
+  }
+
+  // The records kept so far, in the order they were claimed.
+  std::vector<TraceRecord> Records() const {
+    return std::vector<TraceRecord>(records_.get(), records_.get() + Size());
+  }
+
+  // Saves the records to `path`. Returns false on I/O errors.
+  bool WriteFile(const std::string &path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    const uint64_t count = Size();
+    out.write(kMagic, sizeof(kMagic));
+    out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    out.write(reinterpret_cast<const char *>(records_.get()),
+              static_cast<std::streamsize>(count * sizeof(TraceRecord)));
+    return static_cast<bool>(out.flush());
+  }
+
+  // Loads a trace saved by WriteFile, or nullopt if `path` is not one or
+  // holds an unknown op.
+  static std::optional<std::vector<TraceRecord>>
+  ReadFile(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(kMagic)];
+    uint64_t count = 0;
+    if (!in.read(magic, sizeof(magic)) ||
+        std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+        !in.read(reinterpret_cast<char *>(&count), sizeof(count))) {
+      return std::nullopt;
+    }
+    // The count must match the file's length, so that a corrupt header
+    // cannot make us allocate an arbitrary amount.
+    const std::streampos header_end = in.tellg();
+    if (!in.seekg(0, std::ios::end)) {
+      return std::nullopt;
+    }
+    const uint64_t bytes = static_cast<uint64_t>(in.tellg() - header_end);
+    if (bytes % sizeof(TraceRecord) != 0 ||
+        count != bytes / sizeof(TraceRecord) || !in.seekg(header_end)) {
+      return std::nullopt;
+    }
+    std::vector<TraceRecord> records(count);
+    if (!in.read(reinterpret_cast<char *>(records.data()),
+                 static_cast<std::streamsize>(count * sizeof(TraceRecord)))) {
+      return std::nullopt;
+    }
+    for (const TraceRecord &record : records) {
+      if (static_cast<size_t>(record.op) >= kTraceOpCount) {
+        return std::nullopt;
+      }
+    }
+    return records;
+  }
+
+  // Disallow copy (owning resource).
+  OpTrace(const OpTrace &) = delete;
+  OpTrace &operator=(const OpTrace &) = delete;
+
+private:
+  static constexpr char kMagic[8] = {'H', 'P', 'T', 'R', 'A', 'C', 'E', '1'};
+
+  static uint32_t ThreadId() {
+    static std::atomic<uint32_t> next_thread{0};
+    static thread_local const uint32_t id =
+        next_thread.fetch_add(1, std::memory_order_relaxed);
+    return id;
+  }
+
+  const size_t capacity_;
+  std::unique_ptr<TraceRecord[]> records_;
+  const std::chrono::steady_clock::time_point start_;
+  // Next record to claim; may run past capacity_.
+  std::atomic<size_t> next_{0};
+};
+
+} // namespace handle_pool
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "handle_pool/handle_pool.h"
+
+namespace handle_pool {
+
+/*
+ * A byte budget shared by many growable HandlePools.
+ *
+ * Registering a pool installs a growth gate on it. When a pool wants to grow
+ * and the budget has no room, the budget turns to the other pools, least
+ * recently grown first: it calls each one's pressure callback (if any) with
+ * the bytes still needed, so the owner can drop objects it does not need,
+ * then asks the pool to `Shrink`. Growth is refused if not enough storage
+ * could be released.
+ *
+ * A pool's usage is its `StorageBytes()`, read when a decision is made, so
+ * pools may also grow and shrink on their own between decisions. Storage a
+ * pool holds at registration counts toward the budget but is never refused.
+ *
+ * Locking: the budget's mutex is taken before any pool's lock, and pools
+ * call the budget only without holding their own lock. An admitted growth
+ * reserves its bytes under the mutex and grows the pool without it, so
+ * pools grow in parallel. Pressure callbacks and the shrinking of other
+ * pools also run without the mutex, so they may call back into the budget
+ * (a Destroy may itself ask it to grow a pool); the budget is checked again
+ * once they return.
+ *
+ * Thread-safety: every method may be called concurrently. `Unregister`
+ * waits for a reclaim that is calling into the pool to finish, so a
+ * pressure callback must not unregister its own pool. A pool must be
+ * unregistered before it, or the budget, is destroyed.
+ */
+class PoolBudget {
+public:
+  // Called with the number of bytes the budget still needs to free.
+  using PressureCallback = std::function<void(size_t bytes_needed)>;
+
+  explicit PoolBudget(const size_t limit_bytes) : limit_bytes_(limit_bytes) {}
+
+  // Registers a pool. Returns false if it is already registered.
+  template <typename T>
+  bool Register(HandlePool<T> *pool, PressureCallback on_pressure = nullptr) {
+    std::lock_guard<std::mutex> l(mutex_);
+
+    if (FindLocked(pool) != nullptr) {
+      return false;
+    }
+    auto entry = std::make_shared<Entry>();
+    entry->pool = pool;
+    entry->storage_bytes = [pool] { return pool->StorageBytes(); };
+    entry->shrink = [pool](const size_t bytes) { return pool->Shrink(bytes); };
+    entry->on_pressure = std::move(on_pressure);
+    entries_.push_back(std::move(entry));
+    pool->SetGrowthGate(
+        [this, pool](const size_t bytes, const std::function<bool()> &grow) {
+          return Admit(pool, bytes, grow);
+        });
+    return true;
+  }
+
+  // Removes the pool's growth gate, waiting until no other pool's growth
+  // is reclaiming from it. Returns false if it was not registered.
+  template <typename T> bool Unregister(HandlePool<T> *pool) {
+    std::unique_lock<std::mutex> l(mutex_);
+
+    auto it = std::find_if(entries_.begin(), entries_.end(),
+                           [&](const auto &e) { return e->pool == pool; });
+    if (it == entries_.end()) {
+      return false;
+    }
+    const std::shared_ptr<Entry> entry = *it;
+    entries_.erase(it);
+    entry->registered = false;
+    pool->SetGrowthGate(nullptr);
+    reclaimed_.wait(l, [&] { return entry->reclaims == 0; });
+    return true;
+  }
+
+  size_t LimitBytes() {
+    std::lock_guard<std::mutex> l(mutex_);
+    return limit_bytes_;
+  }
+
+  // Changes the limit. Pools above a lowered limit are not shrunk until
+  // another pool asks to grow.
+  void SetLimitBytes(const size_t limit_bytes) {
+    std::lock_guard<std::mutex> l(mutex_);
+    limit_bytes_ = limit_bytes;
+  }
+
+  // Storage bytes currently held by the registered pools.
+  size_t UsedBytes() {
+    std::lock_guard<std::mutex> l(mutex_);
+    return UsedBytesLocked();
+  }
+
+  // Number of growth requests refused so far.
+  size_t DeniedGrowths() {
+    std::lock_guard<std::mutex> l(mutex_);
+    return denied_growths_;
+  }
+
+  // Disallow copy (pools point back at this instance).
+  PoolBudget(const PoolBudget &) = delete;
+  PoolBudget &operator=(const PoolBudget &) = delete;
+
+private:
+  struct Entry {
+    const void *pool = nullptr;
+    std::function<size_t()> storage_bytes;
+    std::function<size_t(size_t)> shrink;
+    PressureCallback on_pressure;
+    // Value of grant_clock_ at the pool's last admitted growth.
+    uint64_t last_growth = 0;
+    // False once unregistered.
+    bool registered = true;
+    // Reclaims calling into the pool right now.
+    size_t reclaims = 0;
+  };
+
+  // Holds `bytes` of the budget for a growth in progress, so that
+  // concurrent growths cannot overshoot the limit between the decision and
+  // the growth showing up in the pool's StorageBytes().
+  class Reservation {
+  public:
+    Reservation(PoolBudget &budget, const size_t bytes)
+        : budget_(budget), bytes_(bytes) {}
+    ~Reservation() {
+      std::lock_guard<std::mutex> l(budget_.mutex_);
+      budget_.reserved_bytes_ -= bytes_;
+    }
+
+    Reservation(const Reservation &) = delete;
+    Reservation &operator=(const Reservation &) = delete;
+
+  private:
+    PoolBudget &budget_;
+    const size_t bytes_;
+  };
+
+  // Marks a reclaim as calling into an entry, so that Unregister waits.
+  class ReclaimPin {
+  public:
+    ReclaimPin(PoolBudget &budget, Entry &entry)
+        : budget_(budget), entry_(entry) {}
+    ~ReclaimPin() {
+      {
+        std::lock_guard<std::mutex> l(budget_.mutex_);
+        --entry_.reclaims;
+      }
+      budget_.reclaimed_.notify_all();
+    }
+
+    ReclaimPin(const ReclaimPin &) = delete;
+    ReclaimPin &operator=(const ReclaimPin &) = delete;
+
+  private:
+    PoolBudget &budget_;
+    Entry &entry_;
+  };
+
+  // The growth gate of every registered pool.
+  bool Admit(const void *pool, const size_t bytes,
+             const std::function<bool()> &grow) {
+    {
+      std::unique_lock<std::mutex> l(mutex_);
+      size_t needed = 0;
+      if (!ReserveLocked(pool, bytes, needed)) {
+        const std::vector<std::shared_ptr<Entry>> victims =
+            VictimsLocked(pool);
+        l.unlock();
+        Reclaim(victims, needed);
+        l.lock();
+        if (!ReserveLocked(pool, bytes, needed)) {
+          ++denied_growths_;
+          return false;
+        }
+      }
+    }
+    Reservation reservation(*this, bytes);
+    return grow();
+  }
+
+  // Reserves `bytes` for the pool's growth if the budget has room for them
+  // (or the pool was unregistered after it fetched its gate) and returns
+  // true. Otherwise sets `needed` to the excess and returns false.
+  bool ReserveLocked(const void *pool, const size_t bytes, size_t &needed) {
+    Entry *self = FindLocked(pool);
+    if (self != nullptr) {
+      const size_t used = UsedBytesLocked() + reserved_bytes_;
+      if (used + bytes > limit_bytes_) {
+        needed = used + bytes - limit_bytes_;
+        return false;
+      }
+      self->last_growth = ++grant_clock_;
+    }
+    reserved_bytes_ += bytes;
+    return true;
+  }
+
+  // The pools other than `requester`, least recently grown first.
+  std::vector<std::shared_ptr<Entry>> VictimsLocked(const void *requester) {
+    std::vector<std::shared_ptr<Entry>> victims;
+    for (const auto &entry : entries_) {
+      if (entry->pool != requester) {
+        victims.push_back(entry);
+      }
+    }
+    std::sort(victims.begin(), victims.end(),
+              [](const auto &a, const auto &b) {
+                return a->last_growth < b->last_growth;
+              });
+    return victims;
+  }
+
+  // Asks `victims` in order to release `needed` bytes (without the mutex),
+  // skipping any unregistered since.
+  void Reclaim(const std::vector<std::shared_ptr<Entry>> &victims,
+               size_t needed) {
+    for (const auto &victim : victims) {
+      if (needed == 0) {
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> l(mutex_);
+        if (!victim->registered) {
+          continue;
+        }
+        ++victim->reclaims;
+      }
+      ReclaimPin pin(*this, *victim);
+      if (victim->on_pressure) {
+        victim->on_pressure(needed);
+      }
+      needed -= std::min(needed, victim->shrink(needed));
+    }
+  }
+
+  Entry *FindLocked(const void *pool) {
+    for (const auto &entry : entries_) {
+      if (entry->pool == pool) {
+        return entry.get();
+      }
+    }
+    return nullptr;
+  }
+
+  size_t UsedBytesLocked() const {
+    size_t used = 0;
+    for (const auto &entry : entries_) {
+      used += entry->storage_bytes();
+    }
+    return used;
+  }
+
+  size_t limit_bytes_;
+  size_t denied_growths_{0};
+  uint64_t grant_clock_{0};
+  // Bytes of admitted growths still in progress.
+  size_t reserved_bytes_{0};
+  // Shared so that a reclaim's list of victims outlives an Unregister.
+  std::vector<std::shared_ptr<Entry>> entries_;
+
+  // Protect all of the above.
+  std::mutex mutex_;
+  // Signalled when a reclaim stops calling into a pool.
+  std::condition_variable reclaimed_;
+};
+
+} // namespace handle_pool
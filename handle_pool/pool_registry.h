@@ -0,0 +1,220 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <optional>
+
+#include "handle_pool/handle_pool.h"
+
+namespace handle_pool {
+
+/*
+ * AnyHandle names an object in any pool of a PoolRegistry. It packs into 64
+ * bits:
+ *   - pool_id    : 8 bits, the pool's id in the registry
+ *   - index      : 24 bits, index into that pool
+ *   - generation : 32 bits, age when created
+ */
+struct AnyHandle {
+  static constexpr uint32_t kIndexBits = 24;
+  static constexpr uint32_t kMaxIndex = (uint32_t{1} << kIndexBits) - 1;
+
+  const uint8_t pool_id;
+  const uint32_t index;
+  const uint32_t generation;
+
+  AnyHandle(const uint8_t pool_id, const uint32_t index,
+            const uint32_t generation)
+      : pool_id(pool_id), index(index & kMaxIndex), generation(generation) {}
+
+  static const AnyHandle Invalid() { return AnyHandle(0xff, kMaxIndex, 0); }
+
+  // The handle within its own pool.
+  const Handle ToHandle() const { return Handle(index, generation); }
+
+  // Packs the handle into one 64-bit word (generation in the high half).
+  uint64_t Pack() const {
+    return (static_cast<uint64_t>(generation) << 32) |
+           (static_cast<uint64_t>(pool_id) << kIndexBits) | index;
+  }
+
+  static const AnyHandle Unpack(const uint64_t word) {
+    return AnyHandle(static_cast<uint8_t>(word >> kIndexBits),
+                     static_cast<uint32_t>(word) & kMaxIndex,
+                     static_cast<uint32_t>(word >> 32));
+  }
+
+  bool operator==(const AnyHandle &other) const {
+    return (pool_id == other.pool_id) && (index == other.index) &&
+           (generation == other.generation);
+  }
+
+  bool operator!=(const AnyHandle &other) const { return !(*this == other); }
+};
+
+inline std::ostream &operator<<(std::ostream &os, const AnyHandle &h) {
+  return os << "AnyHandle { pool: " << static_cast<int>(h.pool_id)
+            << ", idx: " << h.index << ", gen: " << h.generation << " }";
+}
+
+/*
+ * Assigns small ids to HandlePools of different types so that one
+ * AnyHandle can refer to an object in any of them.
+ *
+ * Pools live in a fixed array indexed by pool id. `Resolve<T>` loads the
+ * pool pointer, checks the pool's element type against T and forwards to
+ * `HandlePool<T>::Get`, all in O(1) and without locking the registry.
+ * `Destroy` and `IsValid` need no type and go through per-pool function
+ * pointers.
+ *
+ * Only pools with a capacity of at most 2^24 can be registered, since that
+ * is all an AnyHandle's index can address.
+ *
+ * Thread-safety: every method may be called concurrently. The registry does
+ * not own its pools; a pool must outlive its registration, and handles into
+ * it must not be used once it has been unregistered.
+ */
+class PoolRegistry {
+public:
+  // Pool id 255 is reserved for AnyHandle::Invalid().
+  static constexpr size_t kMaxPools = 255;
+
+  PoolRegistry() = default;
+
+  // Registers a pool, returning its id, or nullopt if the registry is full
+  // or the pool is too large to address.
+  template <typename T>
+  std::optional<uint8_t> Register(HandlePool<T> *pool) {
+    if (pool == nullptr ||
+        pool->MaxCapacity() > size_t{AnyHandle::kMaxIndex}) {
+      return std::nullopt;
+    }
+    std::lock_guard<std::mutex> l(mutex_);
+
+    for (size_t id = 0; id < kMaxPools; ++id) {
+      Entry &entry = entries_[id];
+      if (entry.pool.load(std::memory_order_relaxed) != nullptr) {
+        continue;
+      }
+      entry.type = TypeTag<T>();
+      entry.destroy = [](void *p, const Handle &handle) {
+        return static_cast<HandlePool<T> *>(p)->Destroy(handle);
+      };
+      entry.is_valid = [](void *p, const Handle &handle) {
+        return static_cast<HandlePool<T> *>(p)->IsValid(handle);
+      };
+      // Publishes the fields above to lock-free readers.
+      entry.pool.store(pool, std::memory_order_release);
+      return static_cast<uint8_t>(id);
+    }
+    return std::nullopt;
+  }
+
+  // Frees `pool_id` for reuse. Returns false if it was not registered.
+  bool Unregister(const uint8_t pool_id) {
+    if (pool_id >= kMaxPools) {
+      return false;
+    }
+    std::lock_guard<std::mutex> l(mutex_);
+    return entries_[pool_id].pool.exchange(nullptr,
+                                           std::memory_order_acq_rel) !=
+           nullptr;
+  }
+
+  // Returns the AnyHandle for `handle` in pool `pool_id`, or
+  // AnyHandle::Invalid() if `handle` is invalid.
+  static const AnyHandle Wrap(const uint8_t pool_id, const Handle &handle) {
+    if (handle == Handle::Invalid() || handle.index > AnyHandle::kMaxIndex) {
+      return AnyHandle::Invalid();
+    }
+    return AnyHandle(pool_id, handle.index, handle.generation);
+  }
+
+  // Creates a T in the registered pool `pool_id`, returning an AnyHandle;
+  // AnyHandle::Invalid() if that pool does not hold T or is full.
+  template <typename T, typename... Args>
+  const AnyHandle Create(const uint8_t pool_id, Args &&...args) {
+    HandlePool<T> *pool = PoolAs<T>(pool_id);
+    if (pool == nullptr) {
+      return AnyHandle::Invalid();
+    }
+    return Wrap(pool_id, pool->Create(std::forward<Args>(args)...));
+  }
+
+  // Returns an optional reference to T if the handle is valid and refers to
+  // a pool of T, else nullopt.
+  template <typename T>
+  std::optional<std::reference_wrapper<T>> Resolve(const AnyHandle &handle) {
+    HandlePool<T> *pool = PoolAs<T>(handle.pool_id);
+    if (pool == nullptr) {
+      return std::nullopt;
+    }
+    return pool->Get(handle.ToHandle());
+  }
+
+  // Returns the registered pool of T with id `pool_id`, or nullptr if there
+  // is none.
+  template <typename T> HandlePool<T> *PoolAs(const uint8_t pool_id) {
+    if (pool_id >= kMaxPools) {
+      return nullptr;
+    }
+    const Entry &entry = entries_[pool_id];
+    void *pool = entry.pool.load(std::memory_order_acquire);
+    if (pool == nullptr || entry.type != TypeTag<T>()) {
+      return nullptr;
+    }
+    return static_cast<HandlePool<T> *>(pool);
+  }
+
+  // Returns true if the handle refers to a pool of T (valid or not).
+  template <typename T> bool Holds(const AnyHandle &handle) {
+    return PoolAs<T>(handle.pool_id) != nullptr;
+  }
+
+  // Destroys the object, whatever its type.
+  bool Destroy(const AnyHandle &handle) {
+    const Entry *entry = EntryFor(handle);
+    void *pool = entry ? entry->pool.load(std::memory_order_acquire) : nullptr;
+    return pool != nullptr && entry->destroy(pool, handle.ToHandle());
+  }
+
+  // Checks if a given handle is still valid.
+  bool IsValid(const AnyHandle &handle) {
+    const Entry *entry = EntryFor(handle);
+    void *pool = entry ? entry->pool.load(std::memory_order_acquire) : nullptr;
+    return pool != nullptr && entry->is_valid(pool, handle.ToHandle());
+  }
+
+  // Disallow copy (pool ids are handed out by this instance).
+  PoolRegistry(const PoolRegistry &) = delete;
+  PoolRegistry &operator=(const PoolRegistry &) = delete;
+
+private:
+  struct Entry {
+    // Null while the id is free. Stored last on Register, with release.
+    std::atomic<void *> pool{nullptr};
+    const void *type{nullptr};
+    bool (*destroy)(void *, const Handle &){nullptr};
+    bool (*is_valid)(void *, const Handle &){nullptr};
+  };
+
+  // A distinct address per element type.
+  template <typename T> static const void *TypeTag() {
+    static const char tag = 0;
+    return &tag;
+  }
+
+  const Entry *EntryFor(const AnyHandle &handle) const {
+    return handle.pool_id < kMaxPools ? &entries_[handle.pool_id] : nullptr;
+  }
+
+  std::array<Entry, kMaxPools> entries_;
+  // Serializes Register and Unregister.
+  std::mutex mutex_;
+};
+
+} // namespace handle_pool
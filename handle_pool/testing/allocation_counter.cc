@@ -0,0 +1,163 @@
+#include "handle_pool/testing/allocation_counter.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+// With glibc the malloc family is replaced as well, forwarding to glibc's
+// internal entry points. Sanitizers interpose malloc themselves, so there
+// only operator new is counted.
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define HANDLE_POOL_SANITIZER 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) ||    \
+    __has_feature(memory_sanitizer)
+#define HANDLE_POOL_SANITIZER 1
+#endif
+#endif
+
+#if defined(__GLIBC__) && !defined(HANDLE_POOL_SANITIZER)
+#define HANDLE_POOL_COUNT_MALLOC 1
+#endif
+
+namespace handle_pool {
+namespace testing {
+namespace {
+
+// Initial-exec so that the first access from a thread, which may happen
+// inside malloc, does not itself allocate.
+__attribute__((tls_model("initial-exec"))) thread_local AllocationStats
+    thread_stats;
+
+void Record(const size_t bytes) {
+  ++thread_stats.allocations;
+  thread_stats.bytes += bytes;
+}
+
+} // namespace
+
+AllocationStats ThreadAllocations() { return thread_stats; }
+
+} // namespace testing
+} // namespace handle_pool
+
+#ifdef HANDLE_POOL_COUNT_MALLOC
+
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) {
+  handle_pool::testing::Record(size);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  handle_pool::testing::Record(count * size);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  handle_pool::testing::Record(size);
+  return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+  handle_pool::testing::Record(size);
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  handle_pool::testing::Record(size);
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+  handle_pool::testing::Record(size);
+  void *p = __libc_memalign(alignment, size);
+  if (p == nullptr) {
+    return ENOMEM;
+  }
+  *ptr = p;
+  return 0;
+}
+
+} // extern "C"
+
+#endif // HANDLE_POOL_COUNT_MALLOC
+
+namespace {
+
+// Allocates for the replaced operator new (nullptr on failure).
+void *Allocate(const size_t size, const size_t alignment) {
+#ifndef HANDLE_POOL_COUNT_MALLOC
+  // Not counted by malloc.
+  handle_pool::testing::Record(size);
+#endif
+  if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    return std::malloc(size == 0 ? 1 : size);
+  }
+  void *p = nullptr;
+  return posix_memalign(&p, alignment, size == 0 ? alignment : size) == 0
+             ? p
+             : nullptr;
+}
+
+void *AllocateOrThrow(const size_t size, const size_t alignment) {
+  void *p = Allocate(size, alignment);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+} // namespace
+
+void *operator new(size_t size) {
+  return AllocateOrThrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void *operator new[](size_t size) {
+  return AllocateOrThrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void *operator new(size_t size, std::align_val_t alignment) {
+  return AllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return AllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return Allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return Allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void *operator new(size_t size, std::align_val_t alignment,
+                   const std::nothrow_t &) noexcept {
+  return Allocate(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept {
+  return Allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
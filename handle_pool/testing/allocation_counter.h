@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+
+namespace handle_pool {
+namespace testing {
+
+// Heap allocations made by one thread.
+struct AllocationStats {
+  size_t allocations = 0;
+  size_t bytes = 0;
+};
+
+// Allocations made by the calling thread so far. Counts every global
+// operator new, and with glibc (outside sanitizer builds) also malloc,
+// calloc, realloc and the aligned variants.
+AllocationStats ThreadAllocations();
+
+/*
+ * Counts the heap allocations the current thread makes while it is alive,
+ * for tests and benchmarks that check a code path does not allocate:
+ *
+ *   ScopedAllocationCounter counter;
+ *   pool.Destroy(pool.Create());
+ *   EXPECT_EQ(counter.Allocations(), 0);
+ *
+ * Counting works by replacing the global allocation functions, so the
+ * allocation_counter library must be linked in (it is `alwayslink`).
+ * Allocations made by other threads are not counted.
+ */
+class ScopedAllocationCounter {
+public:
+  ScopedAllocationCounter() : start_(ThreadAllocations()) {}
+
+  // Allocations made since construction.
+  size_t Allocations() const {
+    return ThreadAllocations().allocations - start_.allocations;
+  }
+
+  // Bytes requested by those allocations.
+  size_t Bytes() const { return ThreadAllocations().bytes - start_.bytes; }
+
+private:
+  const AllocationStats start_;
+};
+
+} // namespace testing
+} // namespace handle_pool
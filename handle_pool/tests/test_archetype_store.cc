@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include "handle_pool/archetype_store.h"
+
+struct Position {
+  float x;
+  float y;
+};
+
+struct Velocity {
+  float dx;
+  float dy;
+};
+
+struct Name {
+  std::string value;
+};
+
+using TestStore = handle_pool::ArchetypeStore<Position, Velocity, Name>;
+
+TEST(ArchetypeStoreTest, BasicFunctionalityTest) {
+  TestStore store(2);
+  EXPECT_EQ(store.Capacity(), 2);
+  EXPECT_TRUE(store.Empty());
+
+  const handle_pool::Handle handle1 =
+      store.Create(Position{1, 2}, Velocity{3, 4});
+  EXPECT_TRUE(store.IsValid(handle1));
+  EXPECT_EQ(store.Free(), 1);
+
+  auto position = store.Get<Position>(handle1);
+  ASSERT_TRUE(position.has_value());
+  EXPECT_EQ(position.value().get().x, 1);
+  EXPECT_TRUE(store.Has<Velocity>(handle1));
+  EXPECT_FALSE(store.Has<Name>(handle1));
+  EXPECT_EQ(store.Get<Name>(handle1), std::nullopt);
+
+  EXPECT_TRUE(store.Destroy(handle1));
+  EXPECT_FALSE(store.IsValid(handle1));
+  EXPECT_EQ(store.Get<Position>(handle1), std::nullopt);
+  EXPECT_FALSE(store.Destroy(handle1));
+  EXPECT_TRUE(store.Empty());
+}
+
+TEST(ArchetypeStoreTest, AddRemoveMovesBetweenArchetypesTest) {
+  TestStore store(4);
+
+  const handle_pool::Handle handle1 = store.Create(Position{1, 1});
+  const handle_pool::Handle handle2 = store.Create(Position{2, 2});
+  EXPECT_EQ(store.ArchetypeCount(), 1);
+
+  EXPECT_TRUE(store.Add(handle1, Name{"first"}));
+  EXPECT_FALSE(store.Add(handle1, Name{"again"}));
+  EXPECT_EQ(store.ArchetypeCount(), 2);
+
+  // Both entities keep their components after handle1 moved tables.
+  EXPECT_EQ(store.Get<Position>(handle1).value().get().x, 1);
+  EXPECT_EQ(store.Get<Name>(handle1).value().get().value, "first");
+  EXPECT_EQ(store.Get<Position>(handle2).value().get().x, 2);
+
+  EXPECT_TRUE(store.Remove<Position>(handle1));
+  EXPECT_FALSE(store.Remove<Position>(handle1));
+  EXPECT_FALSE(store.Has<Position>(handle1));
+  EXPECT_EQ(store.Get<Name>(handle1).value().get().value, "first");
+}
+
+TEST(ArchetypeStoreTest, ForEachMatchesSupersetArchetypesTest) {
+  TestStore store(8);
+
+  store.Create(Position{0, 0}, Velocity{1, 0});
+  store.Create(Position{0, 0}, Velocity{0, 1}, Name{"named"});
+  store.Create(Position{5, 5});
+  store.Create(Velocity{9, 9});
+
+  int visited = 0;
+  store.ForEach<Position, Velocity>([&](Position &p, Velocity &v) {
+    p.x += v.dx;
+    p.y += v.dy;
+    ++visited;
+  });
+  EXPECT_EQ(visited, 2);
+
+  float sum = 0;
+  store.ForEach<Position>([&](const Position &p) { sum += p.x + p.y; });
+  EXPECT_EQ(sum, 12);
+}
+
+TEST(ArchetypeStoreTest, ReuseSlotTest) {
+  TestStore store(1);
+
+  const handle_pool::Handle handle1 = store.Create(Position{1, 1});
+  EXPECT_EQ(handle_pool::Handle::Invalid(), store.Create(Position{2, 2}));
+
+  EXPECT_TRUE(store.Destroy(handle1));
+  const handle_pool::Handle handle2 = store.Create(Name{"second"});
+
+  EXPECT_EQ(handle1.index, handle2.index);
+  EXPECT_NE(handle1.generation, handle2.generation);
+  EXPECT_FALSE(store.IsValid(handle1));
+  EXPECT_EQ(store.Get<Name>(handle2).value().get().value, "second");
+}
+
+// Copies throw while `fail` is set; moves never do.
+struct Fragile {
+  explicit Fragile(const int value) : value(value) {}
+  Fragile(const Fragile &other) : value(other.value) {
+    if (fail) {
+      throw std::runtime_error("copy failed");
+    }
+  }
+  Fragile(Fragile &&) noexcept = default;
+  Fragile &operator=(const Fragile &) = default;
+  Fragile &operator=(Fragile &&) noexcept = default;
+
+  static inline bool fail = false;
+  int value;
+};
+
+TEST(ArchetypeStoreTest, ThrowingComponentRollsBackTest) {
+  handle_pool::ArchetypeStore<Position, Fragile> store(4);
+  const handle_pool::Handle handle1 = store.Create(Position{1, 1});
+  const Fragile fragile(7);
+
+  // Position is appended before the Fragile copy throws.
+  Fragile::fail = true;
+  EXPECT_EQ(store.Create(Position{2, 2}, fragile),
+            handle_pool::Handle::Invalid());
+  EXPECT_FALSE(store.Add(handle1, fragile));
+  Fragile::fail = false;
+  EXPECT_EQ(store.Free(), 3);
+  EXPECT_FALSE(store.Has<Fragile>(handle1));
+
+  // Neither failure left a stray row behind.
+  int rows = 0;
+  store.ForEach<Position>([&](Position &) { ++rows; });
+  EXPECT_EQ(rows, 1);
+  const handle_pool::Handle handle2 = store.Create(Position{3, 3}, fragile);
+  EXPECT_TRUE(store.Add(handle1, fragile));
+  store.ForEach<Position, Fragile>([&](Position &position, Fragile &f) {
+    EXPECT_EQ(f.value, 7);
+    EXPECT_TRUE(position.x == 1 || position.x == 3);
+  });
+  EXPECT_EQ(store.Get<Position>(handle1).value().get().x, 1);
+  EXPECT_EQ(store.Get<Position>(handle2).value().get().x, 3);
+}
+
+// Moving throws; copying throws while `fail` is set.
+struct Sticky {
+  explicit Sticky(const int value) : value(value) {}
+  Sticky(const Sticky &other) : value(other.value) {
+    if (fail) {
+      throw std::runtime_error("copy failed");
+    }
+  }
+  Sticky(Sticky &&other) noexcept(false) : Sticky(other) {}
+  Sticky &operator=(const Sticky &) = default;
+  Sticky &operator=(Sticky &&) noexcept = default;
+
+  static inline bool fail = false;
+  int value;
+};
+
+TEST(ArchetypeStoreTest, ThrowingMoveKeepsSourceRowTest) {
+  handle_pool::ArchetypeStore<Name, Sticky, Position> store(4);
+  const handle_pool::Handle handle =
+      store.Create(Name{"a name too long for the small buffer"}, Sticky(5));
+
+  // Name is ordered before Sticky, whose copy throws while the row moves.
+  Sticky::fail = true;
+  EXPECT_FALSE(store.Add(handle, Position{1, 1}));
+  Sticky::fail = false;
+  EXPECT_FALSE(store.Has<Position>(handle));
+  EXPECT_EQ(store.Get<Name>(handle).value().get().value,
+            "a name too long for the small buffer");
+  EXPECT_EQ(store.Get<Sticky>(handle).value().get().value, 5);
+
+  EXPECT_TRUE(store.Add(handle, Position{1, 1}));
+  EXPECT_EQ(store.Get<Name>(handle).value().get().value,
+            "a name too long for the small buffer");
+  EXPECT_EQ(store.Get<Sticky>(handle).value().get().value, 5);
+  EXPECT_TRUE(store.Remove<Position>(handle));
+  EXPECT_EQ(store.Get<Sticky>(handle).value().get().value, 5);
+}
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+#include "handle_pool/batch_executor.h"
+
+TEST(BatchExecutorTest, ResultsInQueueOrderTest) {
+  handle_pool::HandlePool<int> pool(1000);
+  std::vector<uint64_t> handles;
+  for (int i = 0; i < 1000; ++i) {
+    handles.push_back(pool.Create(i).Pack());
+  }
+  std::shuffle(handles.begin(), handles.end(), std::mt19937(7));
+
+  handle_pool::BatchExecutor<int> batch(pool);
+  std::vector<int> seen;
+  for (const uint64_t packed : handles) {
+    batch.Get(handle_pool::Handle::Unpack(packed),
+              [&](const int &value) { seen.push_back(value); });
+  }
+  batch.Get(handle_pool::Handle::Invalid(), [](const int &) { FAIL(); });
+  EXPECT_EQ(batch.Size(), 1001);
+
+  const std::vector<bool> results = batch.Execute();
+  ASSERT_EQ(results.size(), 1001);
+  EXPECT_TRUE(std::all_of(results.begin(), results.end() - 1,
+                          [](bool ok) { return ok; }));
+  EXPECT_FALSE(results.back());
+  EXPECT_EQ(batch.Size(), 0);
+  // Executed in ascending index order.
+  EXPECT_TRUE(std::is_sorted(seen.begin(), seen.end(),
+                             [](int a, int b) { return a > b; }));
+}
+
+TEST(BatchExecutorTest, MixedOperationsTest) {
+  handle_pool::HandlePool<int> pool(300);
+  std::vector<uint64_t> handles;
+  for (int i = 0; i < 300; ++i) {
+    handles.push_back(pool.Create(i).Pack());
+  }
+  const auto handle = [&](size_t i) {
+    return handle_pool::Handle::Unpack(handles[i]);
+  };
+
+  handle_pool::BatchExecutor<int> batch(pool);
+  int read = -1;
+  // Operations on one handle run in the order they were queued.
+  batch.Modify(handle(299), [](int &value) { value = 1000; });
+  batch.Get(handle(299), [&](const int &value) { read = value; });
+  batch.Destroy(handle(0));
+  batch.Destroy(handle(299));
+  batch.Get(handle(299), [&](const int &) { read = -2; });
+  batch.Modify(handle(5), [](int &value) { value += 1; });
+
+  const std::vector<bool> results = batch.Execute();
+  EXPECT_EQ(results, std::vector<bool>({true, true, true, true, false, true}));
+  EXPECT_EQ(read, 1000);
+  EXPECT_FALSE(pool.IsValid(handle(0)));
+  EXPECT_FALSE(pool.IsValid(handle(299)));
+  EXPECT_EQ(pool.Get(handle(5)).value().get(), 6);
+  EXPECT_EQ(pool.Free(), 2);
+}
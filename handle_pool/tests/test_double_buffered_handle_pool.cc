@@ -0,0 +1,82 @@
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <optional>
+#include <thread>
+
+#include "handle_pool/double_buffered_handle_pool.h"
+
+struct Body {
+  int x;
+};
+
+TEST(DoubleBufferedHandlePoolTest, WritesPublishOnSwapTest) {
+  handle_pool::DoubleBufferedHandlePool<Body> pool(4);
+
+  const handle_pool::Handle handle1 = pool.Create(Body{1});
+  EXPECT_TRUE(pool.IsValid(handle1));
+  EXPECT_FALSE(pool.Read().IsValid(handle1));
+
+  EXPECT_EQ(pool.Swap(), 1);
+  EXPECT_EQ(pool.Read().Get(handle1).value().get().x, 1);
+
+  // The next frame starts from the published state.
+  pool.Get(handle1).value().get().x += 10;
+  EXPECT_EQ(pool.Read().Get(handle1).value().get().x, 1);
+  pool.Swap();
+  EXPECT_EQ(pool.Read().Get(handle1).value().get().x, 11);
+
+  // A frame without writes copies nothing.
+  EXPECT_EQ(pool.Swap(), 0);
+  EXPECT_EQ(pool.Read().Get(handle1).value().get().x, 11);
+  pool.Get(handle1).value().get().x += 1;
+  pool.Swap();
+  EXPECT_EQ(pool.Read().Get(handle1).value().get().x, 12);
+}
+
+TEST(DoubleBufferedHandlePoolTest, DestroyPublishesOnSwapTest) {
+  handle_pool::DoubleBufferedHandlePool<Body> pool(1);
+
+  const handle_pool::Handle handle1 = pool.Create(Body{1});
+  pool.Swap();
+
+  EXPECT_TRUE(pool.Destroy(handle1));
+  EXPECT_FALSE(pool.IsValid(handle1));
+  EXPECT_TRUE(pool.Read().IsValid(handle1));
+  pool.Swap();
+  EXPECT_FALSE(pool.Read().IsValid(handle1));
+
+  // The slot is reused with a new generation in both buffers.
+  const handle_pool::Handle handle2 = pool.Create(Body{2});
+  EXPECT_EQ(handle1.index, handle2.index);
+  pool.Swap();
+  pool.Swap();
+  EXPECT_FALSE(pool.Read().IsValid(handle1));
+  EXPECT_EQ(pool.Read().Get(handle2).value().get().x, 2);
+}
+
+TEST(DoubleBufferedHandlePoolTest, SwapWaitsForReadersTest) {
+  handle_pool::DoubleBufferedHandlePool<Body> pool(1);
+  const handle_pool::Handle handle1 = pool.Create(Body{1});
+  pool.Swap();
+
+  std::atomic<bool> swapped{false};
+  {
+    auto view = pool.Read();
+    pool.Get(handle1).value().get().x = 2;
+    std::thread writer([&] {
+      pool.Swap();
+      swapped = true;
+    });
+    // Swap publishes the new frame but cannot recycle the pinned buffer.
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(swapped);
+    EXPECT_EQ(view.Get(handle1).value().get().x, 1);
+
+    // Releasing the view lets Swap finish.
+    { auto released = std::move(view); }
+    writer.join();
+  }
+  EXPECT_TRUE(swapped);
+  EXPECT_EQ(pool.Read().Get(handle1).value().get().x, 2);
+}
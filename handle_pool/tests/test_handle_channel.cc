@@ -0,0 +1,89 @@
+#include <atomic>
+#include <gtest/gtest.h>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "handle_pool/handle_channel.h"
+
+TEST(HandleChannelTest, FifoTest) {
+  handle_pool::HandleChannel channel(4);
+  EXPECT_EQ(channel.Capacity(), 4);
+  EXPECT_EQ(channel.TryPop(), std::nullopt);
+
+  for (uint32_t i = 0; i < 4; ++i) {
+    EXPECT_TRUE(channel.TryPush(handle_pool::Handle(i, i + 10)));
+  }
+  EXPECT_FALSE(channel.TryPush(handle_pool::Handle(9, 9)));
+  EXPECT_EQ(channel.SizeApprox(), 4);
+
+  for (uint32_t i = 0; i < 4; ++i) {
+    EXPECT_EQ(channel.TryPop(), handle_pool::Handle(i, i + 10));
+  }
+  EXPECT_EQ(channel.TryPop(), std::nullopt);
+}
+
+TEST(HandleChannelTest, BatchTest) {
+  handle_pool::HandleChannel channel(8);
+
+  std::vector<handle_pool::Handle> handles;
+  for (uint32_t i = 0; i < 10; ++i) {
+    handles.emplace_back(i, 0);
+  }
+  // Only as many as fit are pushed.
+  EXPECT_EQ(channel.TryPushBatch(handles.data(), 5), 5);
+  EXPECT_EQ(channel.TryPushBatch(handles.data() + 5, 5), 3);
+
+  std::vector<handle_pool::Handle> out;
+  EXPECT_EQ(channel.TryPopBatch(out, 6), 6);
+  EXPECT_EQ(channel.TryPopBatch(out, 6), 2);
+  EXPECT_EQ(channel.TryPopBatch(out, 6), 0);
+  ASSERT_EQ(out.size(), 8);
+  for (uint32_t i = 0; i < 8; ++i) {
+    EXPECT_EQ(out[i].index, i);
+  }
+}
+
+TEST(HandleChannelTest, MultiProducerMultiConsumerTest) {
+  handle_pool::HandleChannel channel(64);
+  constexpr uint32_t kPerProducer = 20000;
+  constexpr int kProducers = 2;
+  constexpr int kConsumers = 2;
+
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint32_t> popped{0};
+  std::vector<std::thread> threads;
+  for (int p = 0; p < kProducers; ++p) {
+    threads.emplace_back([&] {
+      for (uint32_t i = 1; i <= kPerProducer;) {
+        if (i % 2 == 0) {
+          const handle_pool::Handle batch[2] = {{i, 0}, {i + 1, 0}};
+          i += channel.TryPushBatch(batch, i < kPerProducer ? 2 : 1);
+        } else if (channel.TryPush(handle_pool::Handle(i, 0))) {
+          ++i;
+        }
+      }
+    });
+  }
+  for (int c = 0; c < kConsumers; ++c) {
+    threads.emplace_back([&] {
+      std::vector<handle_pool::Handle> out;
+      while (popped < kProducers * kPerProducer) {
+        out.clear();
+        if (channel.TryPopBatch(out, 4) == 0) {
+          std::this_thread::yield();
+        }
+        for (const auto &handle : out) {
+          sum += handle.index;
+        }
+        popped += out.size();
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  const uint64_t expected =
+      kProducers * (uint64_t{kPerProducer} * (kPerProducer + 1) / 2);
+  EXPECT_EQ(sum, expected);
+}
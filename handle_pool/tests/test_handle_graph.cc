@@ -0,0 +1,201 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "handle_pool/handle_graph.h"
+
+using Graph = handle_pool::HandleGraph<std::string, int>;
+
+TEST(HandleGraphTest, AddAndTraverseTest) {
+  Graph graph(8, 16);
+  const handle_pool::Handle a = graph.AddVertex("a");
+  const handle_pool::Handle b = graph.AddVertex("b");
+  const handle_pool::Handle c = graph.AddVertex("c");
+  const handle_pool::Handle d = graph.AddVertex("d");
+  const handle_pool::Handle ab = graph.AddEdge(a, b, 1);
+  graph.AddEdge(a, c, 2);
+  graph.AddEdge(b, d, 3);
+  graph.AddEdge(c, d, 4);
+  graph.AddEdge(d, a, 5);
+
+  EXPECT_EQ(graph.Vertex(b).value().get(), "b");
+  EXPECT_EQ(graph.Edge(ab).value().get(), 1);
+  EXPECT_EQ(graph.Endpoints(ab)->first, a);
+  EXPECT_EQ(graph.Endpoints(ab)->second, b);
+  EXPECT_EQ(graph.OutDegree(a), 2);
+  EXPECT_EQ(graph.VertexCount(), 4);
+  EXPECT_EQ(graph.EdgeCount(), 5);
+
+  std::vector<std::string> order;
+  std::vector<size_t> depths;
+  EXPECT_EQ(graph.Bfs(a,
+                      [&](const handle_pool::Handle &v, size_t depth) {
+                        order.push_back(graph.Vertex(v).value().get());
+                        depths.push_back(depth);
+                      }),
+            4);
+  EXPECT_EQ(order, std::vector<std::string>({"a", "b", "c", "d"}));
+  EXPECT_EQ(depths, std::vector<size_t>({0, 1, 1, 2}));
+
+  EXPECT_EQ(graph.AddEdge(a, handle_pool::Handle::Invalid(), 0),
+            handle_pool::Handle::Invalid());
+}
+
+TEST(HandleGraphTest, RemovalInvalidatesTest) {
+  Graph graph(4, 8);
+  const handle_pool::Handle a = graph.AddVertex("a");
+  const handle_pool::Handle b = graph.AddVertex("b");
+  const handle_pool::Handle c = graph.AddVertex("c");
+  const handle_pool::Handle ab = graph.AddEdge(a, b, 1);
+  const handle_pool::Handle ac = graph.AddEdge(a, c, 2);
+  const handle_pool::Handle ba = graph.AddEdge(b, a, 3);
+
+  EXPECT_TRUE(graph.RemoveEdge(ab));
+  EXPECT_FALSE(graph.RemoveEdge(ab));
+  EXPECT_FALSE(graph.HasEdge(ab));
+  EXPECT_EQ(graph.OutDegree(a), 1);
+
+  // Removing c removes a -> c; removing b removes b -> a.
+  EXPECT_TRUE(graph.RemoveVertex(c));
+  EXPECT_FALSE(graph.HasEdge(ac));
+  EXPECT_EQ(graph.Edge(ac), std::nullopt);
+  EXPECT_EQ(graph.OutDegree(a), 0);
+  EXPECT_TRUE(graph.RemoveVertex(b));
+  EXPECT_FALSE(graph.HasEdge(ba));
+  EXPECT_FALSE(graph.HasVertex(b));
+  EXPECT_EQ(graph.VertexCount(), 1);
+
+  EXPECT_EQ(graph.EdgeCount(), 0);
+  graph.Compact({a});
+  EXPECT_EQ(graph.OutDegree(a), 0);
+
+  // A new vertex in c's slot is not reached through the old edge.
+  graph.AddVertex("e");
+  const handle_pool::Handle f = graph.AddVertex("f");
+  EXPECT_EQ(f.index, c.index);
+  EXPECT_FALSE(graph.HasEdge(ac));
+  EXPECT_EQ(graph.Bfs(a, [](const handle_pool::Handle &, size_t) {}), 1);
+}
+
+TEST(HandleGraphTest, ChurnReclaimsEdgesTest) {
+  Graph graph(2, 4);
+  const handle_pool::Handle hub = graph.AddVertex("hub");
+  // Each round's edge goes with its target, so the edge pool never runs
+  // out.
+  for (int round = 0; round < 100; ++round) {
+    const handle_pool::Handle leaf = graph.AddVertex("leaf");
+    ASSERT_NE(graph.AddEdge(hub, leaf, round), handle_pool::Handle::Invalid());
+    EXPECT_EQ(graph.OutDegree(hub), 1);
+    graph.RemoveVertex(leaf);
+  }
+  EXPECT_EQ(graph.EdgeCount(), 0);
+}
+
+TEST(HandleGraphTest, RemoveEdgeKeepsOrderTest) {
+  Graph graph(4, 8);
+  const handle_pool::Handle a = graph.AddVertex("a");
+  const handle_pool::Handle b = graph.AddVertex("b");
+  std::vector<handle_pool::Handle> edges;
+  for (int i = 0; i < 5; ++i) {
+    edges.push_back(graph.AddEdge(a, b, i));
+  }
+  // Unlink the middle, the head and the tail.
+  EXPECT_TRUE(graph.RemoveEdge(edges[2]));
+  EXPECT_TRUE(graph.RemoveEdge(edges[0]));
+  EXPECT_TRUE(graph.RemoveEdge(edges[4]));
+  EXPECT_EQ(graph.EdgeCount(), 2);
+
+  std::vector<uint64_t> remaining;
+  graph.ForEachOutEdge(a, [&](const handle_pool::Handle &edge,
+                              const handle_pool::Handle &target) {
+    EXPECT_EQ(target, b);
+    remaining.push_back(edge.Pack());
+  });
+  EXPECT_EQ(remaining,
+            std::vector<uint64_t>({edges[1].Pack(), edges[3].Pack()}));
+
+  // The list stays usable after removals at both ends.
+  graph.AddEdge(a, b, 5);
+  EXPECT_EQ(graph.OutDegree(a), 3);
+  EXPECT_TRUE(graph.RemoveVertex(a));
+  EXPECT_EQ(graph.EdgeCount(), 0);
+}
+
+TEST(HandleGraphTest, RemoveVertexReclaimsInEdgesTest) {
+  Graph graph(8, 4);
+  const handle_pool::Handle hub = graph.AddVertex("hub");
+  std::vector<handle_pool::Handle> leaves;
+  for (int i = 0; i < 4; ++i) {
+    leaves.push_back(graph.AddVertex("leaf"));
+    ASSERT_NE(graph.AddEdge(leaves.back(), hub, i),
+              handle_pool::Handle::Invalid());
+  }
+  ASSERT_EQ(graph.AddEdge(hub, leaves[0], 4), handle_pool::Handle::Invalid());
+
+  // The leaves never add another edge, yet removing the hub frees the
+  // edge pool.
+  EXPECT_TRUE(graph.RemoveVertex(hub));
+  EXPECT_EQ(graph.EdgeCount(), 0);
+  for (const handle_pool::Handle &leaf : leaves) {
+    EXPECT_EQ(graph.OutDegree(leaf), 0);
+  }
+  // A self-loop goes with its vertex too.
+  const handle_pool::Handle loop = graph.AddVertex("loop");
+  const handle_pool::Handle self = graph.AddEdge(loop, loop, 7);
+  ASSERT_NE(self, handle_pool::Handle::Invalid());
+  EXPECT_EQ(graph.OutDegree(loop), 1);
+  for (int i = 1; i < 4; ++i) {
+    EXPECT_NE(graph.AddEdge(leaves[i], leaves[0], i),
+              handle_pool::Handle::Invalid());
+  }
+  EXPECT_TRUE(graph.RemoveVertex(loop));
+  EXPECT_FALSE(graph.HasEdge(self));
+  EXPECT_EQ(graph.EdgeCount(), 3);
+}
+
+TEST(HandleGraphTest, RunsMoveAndDropDeadEntriesTest) {
+  using IntGraph = handle_pool::HandleGraph<int, int>;
+  IntGraph graph(4, 256);
+  const handle_pool::Handle a = graph.AddVertex(0);
+  const handle_pool::Handle b = graph.AddVertex(1);
+  const handle_pool::Handle c = graph.AddVertex(2);
+
+  // Interleaving a's and b's edges makes their runs move past each other;
+  // removing every other edge of a leaves dead entries to drop.
+  std::vector<handle_pool::Handle> kept;
+  for (int i = 0; i < 64; ++i) {
+    const handle_pool::Handle ab = graph.AddEdge(a, b, i);
+    ASSERT_NE(graph.AddEdge(b, c, i), handle_pool::Handle::Invalid());
+    if (i % 2 == 0) {
+      kept.push_back(ab);
+    } else {
+      EXPECT_TRUE(graph.RemoveEdge(ab));
+    }
+  }
+  EXPECT_EQ(graph.OutDegree(a), 32);
+  EXPECT_EQ(graph.OutDegree(b), 64);
+
+  // Compacting moves a's entries; the edges must still find them.
+  graph.Compact({a, b});
+  std::vector<int> values;
+  graph.ForEachOutEdge(a, [&](const handle_pool::Handle &edge,
+                              const handle_pool::Handle &target) {
+    EXPECT_EQ(target, b);
+    values.push_back(graph.Edge(edge).value().get());
+  });
+  ASSERT_EQ(values.size(), 32);
+  for (int i = 0; i < 32; ++i) {
+    EXPECT_EQ(values[i], 2 * i);
+  }
+  for (size_t i = 0; i < kept.size(); i += 2) {
+    EXPECT_TRUE(graph.RemoveEdge(kept[i]));
+  }
+  EXPECT_EQ(graph.OutDegree(a), 16);
+
+  // Removing b drops its in-edges from a's run and its out-edges from c's.
+  EXPECT_TRUE(graph.RemoveVertex(b));
+  EXPECT_EQ(graph.OutDegree(a), 0);
+  EXPECT_EQ(graph.EdgeCount(), 0);
+  EXPECT_NE(graph.AddEdge(c, a, 0), handle_pool::Handle::Invalid());
+  EXPECT_EQ(graph.Bfs(c, [](const handle_pool::Handle &, size_t) {}), 2);
+}
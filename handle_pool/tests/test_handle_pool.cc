@@ -1,15 +1,25 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdio>
+#include <future>
 #include <iostream>
 
 #include <gtest/gtest.h>
+#include <memory>
 #include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "handle_pool/handle_pool.h"
 
 struct TestStruct {
   int elem;
-  static int constructor_count;
-  static int destructor_count;
+  static std::atomic<int> constructor_count;
+  static std::atomic<int> destructor_count;
 
   explicit TestStruct() : elem(0) { ++constructor_count; }
 
@@ -27,8 +37,8 @@ struct TestStruct {
   TestStruct &operator=(TestStruct &&) = default;
 };
 
-int TestStruct::constructor_count = 0;
-int TestStruct::destructor_count = 0;
+std::atomic<int> TestStruct::constructor_count{0};
+std::atomic<int> TestStruct::destructor_count{0};
 
 TEST(HandlePoolTest, BasicFunctionalityTest) {
   handle_pool::HandlePool<TestStruct> test_pool(1);
@@ -148,3 +158,706 @@ TEST(HandlePoolTest, ReuseSlotTest) {
   auto obj1 = test_pool.Get(handle1);
   EXPECT_FALSE(obj1.has_value());
 }
+
+TEST(HandlePoolTest, ReorganizeKeepsHandlesValidTest) {
+  handle_pool::HandlePool<TestStruct> test_pool(8);
+
+  std::vector<handle_pool::Handle> handles;
+  for (int i = 0; i < 6; ++i) {
+    handles.push_back(test_pool.Create(i));
+  }
+  test_pool.Destroy(handles[1]);
+
+  // Make the last two objects hot.
+  for (int i = 0; i < 1000; ++i) {
+    test_pool.Get(handles[4]);
+    test_pool.Get(handles[5]);
+  }
+  EXPECT_GT(test_pool.Reorganize(), 0);
+
+  // Hot objects now sit in front of every cold one.
+  const TestStruct *hot4 = &test_pool.Get(handles[4]).value().get();
+  const TestStruct *hot5 = &test_pool.Get(handles[5]).value().get();
+  for (int i : {0, 2, 3}) {
+    auto obj = test_pool.Get(handles[i]);
+    ASSERT_TRUE(obj.has_value());
+    EXPECT_EQ(obj.value().get().elem, i);
+    EXPECT_LT(hot4, &obj.value().get());
+    EXPECT_LT(hot5, &obj.value().get());
+  }
+  EXPECT_EQ(test_pool.Get(handles[4]).value().get().elem, 4);
+  EXPECT_EQ(test_pool.Get(handles[5]).value().get().elem, 5);
+
+  // Stale handles stay stale and free slots are still usable.
+  EXPECT_FALSE(test_pool.IsValid(handles[1]));
+  EXPECT_EQ(test_pool.Free(), 3);
+  const handle_pool::Handle handle6 = test_pool.Create(6);
+  EXPECT_EQ(test_pool.Get(handle6).value().get().elem, 6);
+}
+
+TEST(HandlePoolTest, DestructorDestroysLiveItemsTest) {
+  const int destroyed_before = TestStruct::destructor_count;
+  {
+    handle_pool::HandlePool<TestStruct> test_pool(4);
+    test_pool.Create(1);
+    test_pool.Create(2);
+  }
+  EXPECT_EQ(TestStruct::destructor_count - destroyed_before, 2);
+}
+
+TEST(HandlePoolTest, FreezeTest) {
+  handle_pool::HandlePool<TestStruct> test_pool(4);
+
+  handle_pool::Handle handle1 = test_pool.Create(10);
+  handle_pool::Handle handle2 = test_pool.Create(20);
+  handle_pool::Handle handle3 = test_pool.Create(30);
+  test_pool.Destroy(handle2);
+
+  const handle_pool::FrozenHandlePool<TestStruct> frozen = test_pool.Freeze();
+  EXPECT_EQ(frozen.Capacity(), 4);
+  EXPECT_EQ(frozen.Size(), 2);
+
+  // Handles resolve in the frozen pool and are stale in the source.
+  EXPECT_EQ(frozen.Get(handle1).value().get().elem, 10);
+  EXPECT_EQ(frozen.Get(handle3).value().get().elem, 30);
+  EXPECT_FALSE(frozen.IsValid(handle2));
+  EXPECT_FALSE(frozen.IsValid(handle_pool::Handle::Invalid()));
+  EXPECT_FALSE(test_pool.IsValid(handle1));
+  EXPECT_TRUE(test_pool.Empty());
+
+  // Handles the source issues afterwards are unknown to the frozen pool.
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_FALSE(frozen.IsValid(test_pool.Create(i)));
+  }
+
+  int sum = 0;
+  frozen.ForEach([&](const handle_pool::Handle &handle, const TestStruct &t) {
+    EXPECT_EQ(frozen.Get(handle).value().get().elem, t.elem);
+    sum += t.elem;
+  });
+  EXPECT_EQ(sum, 40);
+
+  int dense_sum = 0;
+  for (const TestStruct &t : frozen) {
+    dense_sum += t.elem;
+  }
+  EXPECT_EQ(dense_sum, 40);
+}
+
+TEST(HandlePoolTest, FreezeRejectsNeverIssuedHandlesTest) {
+  // A slot that was never used still has generation 0, so only the missing
+  // object tells a never-issued handle apart.
+  handle_pool::HandlePool<TestStruct> test_pool(4);
+  handle_pool::Handle handle = test_pool.Create(10);
+  const handle_pool::FrozenHandlePool<TestStruct> frozen = test_pool.Freeze();
+  EXPECT_EQ(frozen.Get(handle).value().get().elem, 10);
+  for (uint32_t i = 0; i < 4; ++i) {
+    if (i == handle.index) {
+      continue;
+    }
+    EXPECT_FALSE(frozen.IsValid(handle_pool::Handle{i, 0}));
+    EXPECT_FALSE(frozen.Get(handle_pool::Handle{i, 0}).has_value());
+  }
+
+  // With no objects at all, a lookup must not index into the empty values.
+  handle_pool::HandlePool<TestStruct> empty_pool(2);
+  const handle_pool::FrozenHandlePool<TestStruct> empty = empty_pool.Freeze();
+  EXPECT_FALSE(empty.Get(handle_pool::Handle{0, 0}).has_value());
+  EXPECT_FALSE(empty.Get(handle_pool::Handle{1, 0}).has_value());
+}
+
+TEST(HandlePoolTest, CloneIsCopyOnWriteTest) {
+  handle_pool::HandlePool<TestStruct> test_pool(4);
+
+  handle_pool::Handle handle1 = test_pool.Create(10);
+  handle_pool::Handle handle2 = test_pool.Create(20);
+
+  std::unique_ptr<handle_pool::HandlePool<TestStruct>> clone =
+      test_pool.Clone();
+  EXPECT_EQ(clone->Capacity(), 4);
+  EXPECT_EQ(clone->Free(), 2);
+
+  // Handles resolve identically and both pools share the same objects until
+  // one of them writes.
+  const auto &const_clone = *clone;
+  EXPECT_EQ(&const_clone.Get(handle1).value().get(),
+            &std::as_const(test_pool).Get(handle1).value().get());
+
+  // Writes in either pool are invisible to the other.
+  clone->Get(handle1).value().get().elem = 11;
+  EXPECT_EQ(test_pool.Get(handle1).value().get().elem, 10);
+  EXPECT_EQ(clone->Get(handle1).value().get().elem, 11);
+
+  EXPECT_TRUE(test_pool.Destroy(handle2));
+  EXPECT_FALSE(test_pool.IsValid(handle2));
+  EXPECT_EQ(clone->Get(handle2).value().get().elem, 20);
+
+  handle_pool::Handle handle3 = clone->Create(30);
+  EXPECT_TRUE(clone->IsValid(handle3));
+  EXPECT_FALSE(test_pool.IsValid(handle3));
+}
+
+TEST(HandlePoolTest, CloneDestroysObjectsOnceTest) {
+  const int destroyed_before = TestStruct::destructor_count;
+  {
+    handle_pool::HandlePool<TestStruct> test_pool(2);
+    test_pool.Create(1);
+    handle_pool::Handle handle2 = test_pool.Create(2);
+    auto clone = test_pool.Clone();
+    // The clone's write copies the chunk, so each pool now owns a copy.
+    clone->Get(handle2).value().get().elem = 3;
+    auto shared_clone = test_pool.Clone();
+  }
+  // Two objects in each of the two distinct chunk copies.
+  EXPECT_EQ(TestStruct::destructor_count - destroyed_before, 4);
+}
+
+TEST(HandlePoolTest, HandlePackTest) {
+  const handle_pool::Handle handle(7, 42);
+  EXPECT_EQ(handle_pool::Handle::Unpack(handle.Pack()), handle);
+  EXPECT_EQ(handle_pool::Handle::Unpack(handle_pool::Handle::Invalid().Pack()),
+            handle_pool::Handle::Invalid());
+}
+
+TEST(HandlePoolTest, GrowAndShrinkTest) {
+  using Pool = handle_pool::HandlePool<TestStruct>;
+  const size_t chunk = Pool::ChunkCapacity();
+  Pool test_pool(handle_pool::HandlePoolOptions{1, 2 * chunk});
+  EXPECT_EQ(test_pool.Capacity(), chunk);
+  EXPECT_EQ(test_pool.MaxCapacity(), 2 * chunk);
+
+  std::vector<handle_pool::Handle> handles;
+  for (size_t i = 0; i < 2 * chunk; ++i) {
+    handles.push_back(test_pool.Create(static_cast<int>(i)));
+    ASSERT_TRUE(test_pool.IsValid(handles.back()));
+  }
+  EXPECT_EQ(test_pool.Capacity(), 2 * chunk);
+  EXPECT_EQ(test_pool.StorageBytes(), 2 * Pool::ChunkBytes());
+  EXPECT_EQ(test_pool.Create(0), handle_pool::Handle::Invalid());
+  EXPECT_EQ(test_pool.Get(handles[0]).value().get().elem, 0);
+
+  // The second chunk is still in use.
+  EXPECT_TRUE(test_pool.Destroy(handles[0]));
+  EXPECT_EQ(test_pool.Shrink(), 0);
+
+  for (size_t i = chunk; i < 2 * chunk; ++i) {
+    EXPECT_TRUE(test_pool.Destroy(handles[i]));
+  }
+  EXPECT_EQ(test_pool.Shrink(), Pool::ChunkBytes());
+  EXPECT_EQ(test_pool.Capacity(), chunk);
+  EXPECT_EQ(test_pool.Free(), 1);
+  EXPECT_EQ(test_pool.Get(handles[1]).value().get().elem, 1);
+  // Never below the initial capacity.
+  EXPECT_EQ(test_pool.Shrink(), 0);
+
+  // Parked slots keep their generations when the pool grows back.
+  EXPECT_TRUE(test_pool.Grow());
+  EXPECT_EQ(test_pool.Capacity(), 2 * chunk);
+  for (size_t i = chunk; i < 2 * chunk; ++i) {
+    EXPECT_FALSE(test_pool.IsValid(handles[i]));
+  }
+}
+
+TEST(HandlePoolTest, ShrinkAfterReorganizeTest) {
+  using Pool = handle_pool::HandlePool<TestStruct>;
+  const size_t chunk = Pool::ChunkCapacity();
+  Pool test_pool(handle_pool::HandlePoolOptions{chunk, 2 * chunk});
+
+  std::vector<handle_pool::Handle> handles;
+  for (size_t i = 0; i < chunk + 1; ++i) {
+    handles.push_back(test_pool.Create(static_cast<int>(i)));
+  }
+  // Free the first chunk's slots and move the survivor to the front, so
+  // that its slot lies in the second chunk but its object in the first.
+  for (size_t i = 0; i < chunk; ++i) {
+    EXPECT_TRUE(test_pool.Destroy(handles[i]));
+  }
+  test_pool.Reorganize();
+  EXPECT_EQ(test_pool.Shrink(), 0);
+
+  EXPECT_TRUE(test_pool.Destroy(handles.back()));
+  EXPECT_EQ(test_pool.Shrink(), Pool::ChunkBytes());
+  EXPECT_EQ(test_pool.Free(), chunk);
+
+  // Every remaining slot gets a distinct position.
+  handles.clear();
+  for (size_t i = 0; i < chunk; ++i) {
+    handles.push_back(test_pool.Create(static_cast<int>(i)));
+  }
+  EXPECT_EQ(test_pool.Capacity(), chunk);
+  for (size_t i = 0; i < chunk; ++i) {
+    EXPECT_EQ(test_pool.Get(handles[i]).value().get().elem,
+              static_cast<int>(i));
+  }
+}
+
+TEST(HandlePoolTest, AutoSizeGrowsAheadOfDemandTest) {
+  using Pool = handle_pool::HandlePool<TestStruct>;
+  const size_t chunk = Pool::ChunkCapacity();
+  handle_pool::HandlePoolOptions options;
+  options.initial_capacity = chunk;
+  options.max_capacity = 8 * chunk;
+  options.auto_size = true;
+  Pool test_pool(options);
+
+  // Growth starts once fewer than grow_headroom of the slots are free, so
+  // the free list never runs dry on the way up.
+  size_t min_free = test_pool.Free();
+  for (size_t i = 0; i < 4 * chunk; ++i) {
+    EXPECT_NE(test_pool.Create(1), handle_pool::Handle::Invalid());
+    min_free = std::min(min_free, test_pool.Free());
+  }
+  EXPECT_GT(min_free, 0);
+  EXPECT_GT(test_pool.Capacity(), 4 * chunk);
+  EXPECT_LE(test_pool.Capacity(), options.max_capacity);
+}
+
+TEST(HandlePoolTest, AutoSizeShrinksAfterSustainedLowUseTest) {
+  using Pool = handle_pool::HandlePool<TestStruct>;
+  const size_t chunk = Pool::ChunkCapacity();
+  handle_pool::HandlePoolOptions options;
+  options.initial_capacity = chunk;
+  options.max_capacity = 4 * chunk;
+  options.auto_size = true;
+  options.window_ops = 64;
+  options.shrink_windows = 4;
+  Pool test_pool(options);
+
+  std::vector<handle_pool::Handle> handles;
+  for (size_t i = 0; i < 3 * chunk; ++i) {
+    handles.push_back(test_pool.Create(1));
+  }
+  const size_t grown = test_pool.Capacity();
+  EXPECT_GT(grown, 3 * chunk);
+
+  const size_t churn = 2 * options.shrink_windows * options.window_ops;
+
+  // Destroy from the back so that the low slots are reused first. Occupancy
+  // between the shrink and grow thresholds leaves the capacity alone.
+  while (handles.size() > 2 * chunk) {
+    EXPECT_TRUE(test_pool.Destroy(handles.back()));
+    handles.pop_back();
+  }
+  for (size_t i = 0; i < churn; ++i) {
+    EXPECT_TRUE(test_pool.Destroy(test_pool.Create(2)));
+  }
+  EXPECT_EQ(test_pool.Capacity(), grown);
+
+  // Sustained low occupancy shrinks the pool back to its initial capacity.
+  while (handles.size() > 8) {
+    EXPECT_TRUE(test_pool.Destroy(handles.back()));
+    handles.pop_back();
+  }
+  for (size_t i = 0; i < churn; ++i) {
+    EXPECT_TRUE(test_pool.Destroy(test_pool.Create(2)));
+  }
+  EXPECT_EQ(test_pool.Capacity(), chunk);
+  for (const auto &handle : handles) {
+    EXPECT_TRUE(test_pool.IsValid(handle));
+  }
+}
+
+TEST(HandlePoolTest, TenantQuotaTest) {
+  handle_pool::HandlePoolOptions options;
+  options.initial_capacity = 6;
+  options.max_tenants = 2;
+  handle_pool::HandlePool<TestStruct> test_pool(options);
+  const handle_pool::TenantId noisy(0);
+  const handle_pool::TenantId quiet(1);
+
+  EXPECT_FALSE(test_pool.SetTenantQuota(handle_pool::TenantId(2), {}));
+  EXPECT_FALSE(test_pool.SetTenantQuota(noisy, {3, 2}));
+  EXPECT_FALSE(test_pool.SetTenantQuota(quiet, {7}));
+  EXPECT_TRUE(test_pool.SetTenantQuota(noisy, {0, 4}));
+  EXPECT_TRUE(test_pool.SetTenantQuota(quiet, {2}));
+
+  // The noisy tenant stops at its maximum...
+  std::vector<handle_pool::Handle> noisy_handles;
+  for (int i = 0; i < 4; ++i) {
+    noisy_handles.push_back(test_pool.Create(noisy, i));
+    EXPECT_TRUE(test_pool.IsValid(noisy_handles.back()));
+  }
+  EXPECT_EQ(test_pool.Create(noisy, 4), handle_pool::Handle::Invalid());
+  EXPECT_EQ(test_pool.TenantObjects(noisy), 4);
+
+  // ...and neither it nor untenanted callers get the quiet tenant's slots.
+  EXPECT_TRUE(test_pool.Destroy(noisy_handles.back()));
+  EXPECT_EQ(test_pool.Free(), 3);
+  const handle_pool::Handle shared = test_pool.Create(10);
+  EXPECT_TRUE(test_pool.IsValid(shared));
+  EXPECT_EQ(test_pool.Create(11), handle_pool::Handle::Invalid());
+  EXPECT_EQ(test_pool.Create(noisy, 12), handle_pool::Handle::Invalid());
+
+  const handle_pool::Handle q1 = test_pool.Create(quiet, 20);
+  const handle_pool::Handle q2 = test_pool.Create(quiet, 21);
+  EXPECT_EQ(test_pool.Get(q2).value().get().elem, 21);
+  EXPECT_EQ(test_pool.TenantObjects(quiet), 2);
+  EXPECT_EQ(test_pool.Free(), 0);
+
+  EXPECT_TRUE(test_pool.Destroy(q1));
+  EXPECT_EQ(test_pool.TenantObjects(quiet), 1);
+  EXPECT_EQ(test_pool.Create(12), handle_pool::Handle::Invalid());
+  EXPECT_TRUE(test_pool.IsValid(test_pool.Create(quiet, 22)));
+  EXPECT_EQ(test_pool.Create(handle_pool::TenantId(5), 0),
+            handle_pool::Handle::Invalid());
+}
+
+TEST(HandlePoolTest, MemoryStatsTest) {
+  struct Padded {
+    double value;
+    char tag;
+  };
+  using Pool = handle_pool::HandlePool<Padded>;
+  const size_t chunk = Pool::ChunkCapacity();
+  Pool test_pool(2 * chunk);
+
+  handle_pool::HandlePoolMemoryStats stats = test_pool.MemoryStats();
+  EXPECT_EQ(stats.live_bytes, 0);
+  EXPECT_GE(stats.reserved_bytes, 2 * chunk * sizeof(Padded));
+  EXPECT_LE(stats.committed_bytes, stats.reserved_bytes);
+  // The in-use flag adds a whole alignment unit per slot.
+  EXPECT_GE(stats.metadata_bytes, 2 * chunk * alignof(Padded));
+  EXPECT_EQ(stats.live_page_fraction, 0.0);
+
+  // Touch every slot, then keep one object per 64 slots.
+  std::vector<handle_pool::Handle> handles;
+  for (size_t i = 0; i < 2 * chunk; ++i) {
+    handles.push_back(test_pool.Create(Padded{1.0, 'x'}));
+  }
+  stats = test_pool.MemoryStats();
+  EXPECT_EQ(stats.live_bytes, 2 * chunk * sizeof(Padded));
+  EXPECT_EQ(stats.committed_bytes, stats.reserved_bytes);
+  EXPECT_EQ(stats.live_page_fraction, 1.0);
+  EXPECT_EQ(stats.live_cache_line_fraction, 1.0);
+
+  for (size_t i = 0; i < handles.size(); ++i) {
+    if (i % 64 != 0) {
+      test_pool.Destroy(handles[i]);
+    }
+  }
+  stats = test_pool.MemoryStats();
+  EXPECT_EQ(stats.live_bytes, 2 * chunk / 64 * sizeof(Padded));
+  EXPECT_GT(stats.live_page_fraction, 0.9);
+  EXPECT_LT(stats.live_cache_line_fraction, 0.1);
+}
+
+TEST(HandlePoolTest, PrefaultTest) {
+  using Pool = handle_pool::HandlePool<TestStruct>;
+  const size_t chunk = Pool::ChunkCapacity();
+  Pool test_pool(handle_pool::HandlePoolOptions{chunk, 4 * chunk});
+  const handle_pool::Handle handle = test_pool.Create(5);
+
+  EXPECT_GE(test_pool.Prefault(), test_pool.StorageBytes());
+  const handle_pool::HandlePoolMemoryStats stats = test_pool.MemoryStats();
+  EXPECT_EQ(stats.committed_bytes, stats.reserved_bytes);
+  // Live objects are left alone.
+  EXPECT_EQ(test_pool.Get(handle).value().get().elem, 5);
+  EXPECT_EQ(test_pool.PinnedBytes(), 0);
+}
+
+TEST(HandlePoolTest, LockMemoryTest) {
+  using Pool = handle_pool::HandlePool<TestStruct>;
+  const size_t chunk = Pool::ChunkCapacity();
+  handle_pool::HandlePoolOptions options;
+  options.initial_capacity = chunk;
+  options.max_capacity = 2 * chunk;
+  options.lock_memory = true;
+  Pool test_pool(options);
+
+  // Locking may be refused by RLIMIT_MEMLOCK; whatever is reported as
+  // pinned must be whole chunks of storage.
+  const size_t pinned = test_pool.PinnedBytes();
+  EXPECT_TRUE(pinned == 0 || pinned == test_pool.StorageBytes());
+  EXPECT_TRUE(test_pool.Grow());
+  EXPECT_EQ(test_pool.PinnedBytes() % Pool::ChunkBytes(), 0);
+  EXPECT_LE(test_pool.PinnedBytes(), test_pool.StorageBytes());
+  EXPECT_GT(test_pool.Shrink(), 0);
+  EXPECT_LE(test_pool.PinnedBytes(), test_pool.StorageBytes());
+}
+
+TEST(HandlePoolTest, ParallelInitAndTeardownTest) {
+  using Pool = handle_pool::HandlePool<TestStruct>;
+  const size_t chunk = Pool::ChunkCapacity();
+  std::atomic<size_t> setup_calls{0};
+  handle_pool::HandlePoolOptions options;
+  options.initial_capacity = 5 * chunk + 3;
+  options.init_threads = 4;
+  options.init_thread_setup = [&](const size_t thread) {
+    EXPECT_LT(thread, 4);
+    ++setup_calls;
+  };
+
+  const int destroyed_before = TestStruct::destructor_count;
+  {
+    Pool test_pool(options);
+    EXPECT_EQ(setup_calls, 4);
+    EXPECT_EQ(test_pool.Capacity(), 5 * chunk + 3);
+    EXPECT_EQ(test_pool.Free(), 5 * chunk + 3);
+
+    // The free list is in the same order as with a single thread.
+    const handle_pool::Handle first = test_pool.Create(1);
+    EXPECT_EQ(first.index, 5 * chunk + 2);
+    for (size_t i = 1; i < 5 * chunk + 3; ++i) {
+      test_pool.Create(static_cast<int>(i));
+    }
+    EXPECT_EQ(test_pool.Free(), 0);
+    EXPECT_EQ(test_pool.Get(first).value().get().elem, 1);
+  }
+  EXPECT_EQ(setup_calls, 8);
+  EXPECT_EQ(static_cast<size_t>(TestStruct::destructor_count -
+                                destroyed_before),
+            5 * chunk + 3);
+}
+
+TEST(HandlePoolTest, CheckpointTest) {
+  struct Point {
+    int x;
+    int y;
+  };
+  using Pool = handle_pool::HandlePool<Point>;
+  const std::string path = ::testing::TempDir() + "/handle_pool_checkpoint";
+  const size_t chunk = Pool::ChunkCapacity();
+  Pool test_pool(2 * chunk + 5);
+
+  std::vector<handle_pool::Handle> handles;
+  for (int i = 0; i < static_cast<int>(2 * chunk); ++i) {
+    handles.push_back(test_pool.Create(Point{i, -i}));
+  }
+  EXPECT_TRUE(test_pool.Destroy(handles[7]));
+  std::future<bool> done = test_pool.CheckpointAsync(path);
+
+  // The pool keeps working while the checkpoint is written; none of these
+  // changes are in it.
+  test_pool.Get(handles[0]).value().get().x = 1000;
+  EXPECT_TRUE(test_pool.Destroy(handles[1]));
+  const handle_pool::Handle later = test_pool.Create(Point{5, 5});
+  ASSERT_TRUE(done.get());
+
+  std::unique_ptr<Pool> restored = Pool::RestoreCheckpoint(path);
+  ASSERT_NE(restored, nullptr);
+  EXPECT_EQ(restored->Capacity(), test_pool.Capacity());
+  EXPECT_EQ(restored->Free(), 6);
+  EXPECT_EQ(restored->Get(handles[0]).value().get().x, 0);
+  EXPECT_EQ(restored->Get(handles[1]).value().get().y, -1);
+  EXPECT_EQ(restored->Get(handles[2 * chunk - 1]).value().get().x,
+            static_cast<int>(2 * chunk - 1));
+  EXPECT_FALSE(restored->IsValid(handles[7]));
+  EXPECT_FALSE(restored->IsValid(later));
+  // Slots freed before the checkpoint are reused without reviving handles.
+  const handle_pool::Handle reused = restored->Create(Point{1, 1});
+  EXPECT_NE(reused, handles[7]);
+  EXPECT_TRUE(restored->IsValid(reused));
+
+  // Not a checkpoint of a pool of Point.
+  EXPECT_EQ(handle_pool::HandlePool<double>::RestoreCheckpoint(path),
+            nullptr);
+  EXPECT_EQ(Pool::RestoreCheckpoint(path + ".missing"), nullptr);
+
+  // An item's flags follow its storage; flags other than a 0 or 1 in_use
+  // and a 0 reserved are rejected. The header is the magic, item size,
+  // capacity and slot count, followed by two uint32_ts per slot.
+  uint64_t header[4];
+  std::FILE *file = std::fopen(path.c_str(), "r+b");
+  ASSERT_NE(file, nullptr);
+  ASSERT_EQ(std::fread(header, sizeof(header), 1, file), 1u);
+  const long flags = static_cast<long>(sizeof(header) + 8 * header[3] +
+                                       3 * header[1] + sizeof(Point));
+  for (const unsigned char bad : {2, 0x80}) {
+    for (const long offset : {flags, flags + 1}) {
+      unsigned char original;
+      std::fseek(file, offset, SEEK_SET);
+      ASSERT_EQ(std::fread(&original, 1, 1, file), 1u);
+      std::fseek(file, offset, SEEK_SET);
+      std::fwrite(&bad, 1, 1, file);
+      std::fflush(file);
+      EXPECT_EQ(Pool::RestoreCheckpoint(path), nullptr);
+      std::fseek(file, offset, SEEK_SET);
+      std::fwrite(&original, 1, 1, file);
+      std::fflush(file);
+    }
+  }
+  std::fclose(file);
+  EXPECT_NE(Pool::RestoreCheckpoint(path), nullptr);
+  std::remove(path.c_str());
+}
+
+TEST(HandlePoolTest, CheckpointKeepsParkedSlotsTest) {
+  using Pool = handle_pool::HandlePool<uint64_t>;
+  const std::string path = ::testing::TempDir() + "/handle_pool_parked";
+  const size_t chunk = Pool::ChunkCapacity();
+  const handle_pool::HandlePoolOptions options{chunk, 2 * chunk};
+  Pool test_pool(options);
+
+  // Grow, empty and shrink the pool, parking the second chunk's slots.
+  const uint64_t secret = 0x5ec7e75ec7e75ec7;
+  std::vector<uint64_t> issued;
+  for (size_t i = 0; i < 2 * chunk; ++i) {
+    issued.push_back(test_pool.Create(secret).Pack());
+  }
+  for (const uint64_t packed : issued) {
+    EXPECT_TRUE(test_pool.Destroy(handle_pool::Handle::Unpack(packed)));
+  }
+  EXPECT_GT(test_pool.Shrink(), 0);
+  ASSERT_EQ(test_pool.Capacity(), chunk);
+  ASSERT_TRUE(test_pool.CheckpointAsync(path).get());
+
+  // Destroyed objects are not in the file.
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  ASSERT_NE(file, nullptr);
+  uint64_t word;
+  while (std::fread(&word, sizeof(word), 1, file) == 1) {
+    ASSERT_NE(word, secret);
+  }
+  std::fclose(file);
+
+  // Growing the restored pool back must not reissue any handle.
+  std::unique_ptr<Pool> restored = Pool::RestoreCheckpoint(path, options);
+  ASSERT_NE(restored, nullptr);
+  EXPECT_EQ(restored->Capacity(), chunk);
+  std::sort(issued.begin(), issued.end());
+  for (size_t i = 0; i < 2 * chunk; ++i) {
+    const handle_pool::Handle handle = restored->Create(i);
+    ASSERT_NE(handle, handle_pool::Handle::Invalid());
+    EXPECT_FALSE(
+        std::binary_search(issued.begin(), issued.end(), handle.Pack()));
+  }
+  EXPECT_EQ(restored->Capacity(), 2 * chunk);
+  std::remove(path.c_str());
+}
+
+TEST(HandlePoolTest, TwoPhaseCreateTest) {
+  handle_pool::HandlePool<TestStruct> test_pool(3);
+
+  handle_pool::PendingHandle<TestStruct> pending = test_pool.Reserve();
+  ASSERT_TRUE(pending.IsReserved());
+  const handle_pool::Handle handle = pending.handle();
+  EXPECT_FALSE(test_pool.IsValid(handle));
+  EXPECT_EQ(test_pool.Free(), 2);
+  // Nothing to publish yet.
+  EXPECT_EQ(test_pool.Publish(pending), handle_pool::Handle::Invalid());
+
+  // Constructed on another thread while the pool keeps serving requests.
+  const handle_pool::Handle other = test_pool.Create(1);
+  std::thread builder([&] { pending.Construct(42); });
+  EXPECT_EQ(test_pool.Get(other).value().get().elem, 1);
+  builder.join();
+  EXPECT_FALSE(test_pool.IsValid(handle));
+
+  EXPECT_EQ(test_pool.Publish(pending), handle);
+  EXPECT_FALSE(pending.IsReserved());
+  EXPECT_EQ(test_pool.Get(handle).value().get().elem, 42);
+  EXPECT_EQ(test_pool.Publish(pending), handle_pool::Handle::Invalid());
+  EXPECT_FALSE(test_pool.Abandon(pending));
+
+  // An abandoned reservation destroys its object and never becomes valid.
+  handle_pool::PendingHandle<TestStruct> dropped = test_pool.Reserve();
+  const handle_pool::Handle dropped_handle = dropped.handle();
+  dropped.Construct(7);
+  const int destroyed_before = TestStruct::destructor_count;
+  EXPECT_TRUE(test_pool.Abandon(dropped));
+  EXPECT_EQ(TestStruct::destructor_count, destroyed_before + 1);
+  EXPECT_FALSE(test_pool.IsValid(dropped_handle));
+  const handle_pool::Handle reused = test_pool.Create(8);
+  EXPECT_EQ(reused.index, dropped_handle.index);
+  EXPECT_NE(reused, dropped_handle);
+
+  // Reservations take slots like objects do.
+  EXPECT_TRUE(test_pool.Destroy(reused));
+  handle_pool::PendingHandle<TestStruct> last = test_pool.Reserve();
+  EXPECT_TRUE(last.IsReserved());
+  EXPECT_FALSE(test_pool.Reserve().IsReserved());
+  EXPECT_EQ(test_pool.Create(0), handle_pool::Handle::Invalid());
+  EXPECT_TRUE(test_pool.Abandon(last));
+}
+
+TEST(HandlePoolTest, ReservationsSurviveCloneFreezeAndShrinkTest) {
+  using Pool = handle_pool::HandlePool<TestStruct>;
+  const size_t chunk = Pool::ChunkCapacity();
+  Pool test_pool(handle_pool::HandlePoolOptions{1, 2 * chunk});
+  std::vector<handle_pool::Handle> handles;
+  for (size_t i = 0; i < chunk; ++i) {
+    handles.push_back(test_pool.Create(static_cast<int>(i)));
+  }
+  // Grows the pool; the reserved slot is in the second chunk.
+  handle_pool::PendingHandle<TestStruct> pending = test_pool.Reserve();
+  ASSERT_TRUE(pending.IsReserved());
+  EXPECT_EQ(test_pool.Capacity(), 2 * chunk);
+  TestStruct &obj = pending.Construct(5);
+
+  // The clone gets its own copy of the chunk and a free slot.
+  std::unique_ptr<Pool> clone = test_pool.Clone();
+  EXPECT_EQ(clone->Free(), test_pool.Free() + 1);
+  EXPECT_FALSE(clone->IsValid(pending.handle()));
+  obj.elem = 6;
+
+  EXPECT_EQ(test_pool.Reorganize(), 0);
+  handle_pool::FrozenHandlePool<TestStruct> frozen = test_pool.Freeze();
+  EXPECT_EQ(frozen.Size(), chunk);
+  EXPECT_FALSE(frozen.IsValid(pending.handle()));
+  EXPECT_EQ(test_pool.Free(), 2 * chunk - 1);
+
+  // The reservation pins the second chunk.
+  EXPECT_EQ(test_pool.Shrink(), 0);
+  const handle_pool::Handle handle = test_pool.Publish(pending);
+  ASSERT_NE(handle, handle_pool::Handle::Invalid());
+  EXPECT_EQ(test_pool.Get(handle).value().get().elem, 6);
+  EXPECT_TRUE(test_pool.Destroy(handle));
+  EXPECT_EQ(test_pool.Shrink(), Pool::ChunkBytes());
+}
+
+TEST(HandlePoolTest, PrefaultLeavesReservationsAloneTest) {
+  handle_pool::HandlePool<int> int_pool(4);
+  handle_pool::PendingHandle<int> pending = int_pool.Reserve();
+  pending.Construct(0x12345678);
+  EXPECT_GT(int_pool.Prefault(), 0);
+  const handle_pool::Handle handle = int_pool.Publish(pending);
+  ASSERT_NE(handle, handle_pool::Handle::Invalid());
+  EXPECT_EQ(int_pool.Get(handle).value().get(), 0x12345678);
+
+  // An item this small ends in its flags, which must survive too.
+  handle_pool::HandlePool<char> char_pool(4);
+  handle_pool::PendingHandle<char> pending_char = char_pool.Reserve();
+  pending_char.Construct('x');
+  char_pool.Prefault();
+  const handle_pool::Handle char_handle = char_pool.Publish(pending_char);
+  ASSERT_NE(char_handle, handle_pool::Handle::Invalid());
+  EXPECT_EQ(char_pool.Get(char_handle).value().get(), 'x');
+}
+
+TEST(HandlePoolTest, DroppedReservationIsAbandonedTest) {
+  using Pool = handle_pool::HandlePool<TestStruct>;
+  const size_t chunk = Pool::ChunkCapacity();
+  Pool test_pool(handle_pool::HandlePoolOptions{1, 2 * chunk});
+  std::vector<handle_pool::Handle> handles;
+  for (size_t i = 0; i < chunk; ++i) {
+    handles.push_back(test_pool.Create(static_cast<int>(i)));
+  }
+
+  // An exception between Reserve and Publish drops the reservation, which
+  // lands in the second chunk.
+  uint64_t reserved = handle_pool::Handle::Invalid().Pack();
+  const int destroyed_before = TestStruct::destructor_count;
+  try {
+    handle_pool::PendingHandle<TestStruct> pending = test_pool.Reserve();
+    ASSERT_TRUE(pending.IsReserved());
+    reserved = pending.handle().Pack();
+    pending.Construct(5);
+    throw std::runtime_error("publish never reached");
+  } catch (const std::runtime_error &) {
+  }
+  EXPECT_EQ(TestStruct::destructor_count, destroyed_before + 1);
+  EXPECT_FALSE(test_pool.IsValid(handle_pool::Handle::Unpack(reserved)));
+  EXPECT_EQ(test_pool.Free(), chunk);
+
+  // Nothing pins the second chunk or blocks Reorganize.
+  EXPECT_EQ(test_pool.Reorganize(), 0);
+  EXPECT_EQ(test_pool.Shrink(), Pool::ChunkBytes());
+
+  // A moved-from or published PendingHandle abandons nothing.
+  handle_pool::PendingHandle<TestStruct> pending = test_pool.Reserve();
+  handle_pool::PendingHandle<TestStruct> moved(std::move(pending));
+  moved.Construct(6);
+  const handle_pool::Handle handle = test_pool.Publish(moved);
+  ASSERT_NE(handle, handle_pool::Handle::Invalid());
+  EXPECT_EQ(test_pool.Get(handle).value().get().elem, 6);
+}
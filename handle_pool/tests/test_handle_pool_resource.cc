@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "handle_pool/handle_pool_resource.h"
+
+TEST(HandlePoolResourceTest, PmrMapUsesSlabTest) {
+  handle_pool::HandlePoolResource resource(64, 128);
+  EXPECT_EQ(resource.BlockSize(), 64);
+  EXPECT_EQ(resource.FreeBlocks(), 128);
+  {
+    std::pmr::map<int, int> map(&resource);
+    for (int i = 0; i < 100; ++i) {
+      map[i] = i;
+    }
+    EXPECT_EQ(resource.FreeBlocks(), 28);
+    EXPECT_EQ(resource.UpstreamAllocations(), 0);
+
+    for (int i = 0; i < 50; ++i) {
+      map.erase(i);
+    }
+    EXPECT_EQ(resource.FreeBlocks(), 78);
+  }
+  EXPECT_EQ(resource.FreeBlocks(), 128);
+}
+
+TEST(HandlePoolResourceTest, FallsBackToUpstreamTest) {
+  handle_pool::HandlePoolResource resource(32, 2);
+
+  std::pmr::unordered_map<int, int> map(&resource);
+  for (int i = 0; i < 16; ++i) {
+    map[i] = i;
+  }
+  // Bucket arrays and nodes beyond the slab come from upstream.
+  EXPECT_GT(resource.UpstreamAllocations(), 0);
+  for (int i = 0; i < 16; ++i) {
+    EXPECT_EQ(map.at(i), i);
+  }
+}
+
+TEST(HandlePoolResourceTest, ClassicAllocatorTest) {
+  handle_pool::HandlePoolResource resource(64, 16);
+  using Allocator = handle_pool::HandlePoolAllocator<int>;
+
+  std::list<int, Allocator> list{Allocator(&resource)};
+  for (int i = 0; i < 10; ++i) {
+    list.push_back(i);
+  }
+  EXPECT_EQ(resource.FreeBlocks(), 6);
+  EXPECT_EQ(list.get_allocator(),
+            handle_pool::HandlePoolAllocator<double>(&resource));
+  list.clear();
+  EXPECT_EQ(resource.FreeBlocks(), 16);
+}
+
+TEST(HandlePoolResourceTest, ConcurrentAllocateDeallocateTest) {
+  handle_pool::HandlePoolResource resource(16, 64);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&resource] {
+      std::vector<void *> blocks;
+      for (int round = 0; round < 1000; ++round) {
+        for (int i = 0; i < 8; ++i) {
+          blocks.push_back(resource.allocate(16));
+        }
+        for (void *block : blocks) {
+          resource.deallocate(block, 16);
+        }
+        blocks.clear();
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(resource.FreeBlocks(), 64);
+  EXPECT_EQ(resource.UpstreamAllocations(), 0);
+}
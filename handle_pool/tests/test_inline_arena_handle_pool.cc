@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "handle_pool/inline_arena_handle_pool.h"
+
+struct Message {
+  std::pmr::string topic;
+  std::pmr::vector<int> values;
+
+  Message(std::string_view topic, std::pmr::memory_resource *resource)
+      : topic(topic, resource), values(resource) {}
+};
+
+TEST(InlineArenaHandlePoolTest, SmallAllocationsStayInlineTest) {
+  handle_pool::InlineArenaHandlePool<Message, 256> pool(2);
+
+  const handle_pool::Handle handle1 =
+      pool.Create("a topic name that does not fit in SSO");
+  auto message = pool.Get(handle1);
+  ASSERT_TRUE(message.has_value());
+  for (int i = 0; i < 8; ++i) {
+    message.value().get().values.push_back(i);
+  }
+  EXPECT_EQ(message.value().get().topic,
+            "a topic name that does not fit in SSO");
+  EXPECT_EQ(message.value().get().values.size(), 8);
+
+  auto stats = pool.Stats(handle1);
+  ASSERT_TRUE(stats.has_value());
+  EXPECT_GT(stats->inline_bytes, 0);
+  EXPECT_LE(stats->inline_bytes, 256);
+  EXPECT_EQ(stats->overflow_allocations, 0);
+
+  EXPECT_TRUE(pool.Destroy(handle1));
+  EXPECT_FALSE(pool.IsValid(handle1));
+  EXPECT_EQ(pool.Stats(handle1), std::nullopt);
+}
+
+TEST(InlineArenaHandlePoolTest, OverflowGoesUpstreamTest) {
+  handle_pool::InlineArenaHandlePool<Message, 64> pool(1);
+
+  const handle_pool::Handle handle1 = pool.Create("topic");
+  auto &message = pool.Get(handle1).value().get();
+  for (int i = 0; i < 100; ++i) {
+    message.values.push_back(i);
+  }
+  EXPECT_EQ(message.values[99], 99);
+  EXPECT_GT(pool.Stats(handle1)->overflow_allocations, 0);
+
+  // The slot can be reused with a fresh arena.
+  EXPECT_TRUE(pool.Destroy(handle1));
+  const handle_pool::Handle handle2 = pool.Create("again");
+  EXPECT_EQ(pool.Stats(handle2)->overflow_allocations, 0);
+  EXPECT_EQ(pool.Get(handle2).value().get().topic, "again");
+}
+
+TEST(SlotArenaTest, LastAllocationRollsBackTest) {
+  alignas(std::max_align_t) std::byte buffer[128];
+  handle_pool::SlotArena arena(buffer, sizeof(buffer));
+
+  void *first = arena.allocate(16);
+  void *second = arena.allocate(32);
+  EXPECT_EQ(arena.InlineBytesUsed(), 48);
+  arena.deallocate(second, 32);
+  EXPECT_EQ(arena.InlineBytesUsed(), 16);
+  // Freeing an older allocation leaves the bump pointer alone.
+  arena.deallocate(first, 16);
+  EXPECT_EQ(arena.InlineBytesUsed(), 16);
+}
@@ -0,0 +1,94 @@
+#include <cstddef>
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "handle_pool/handle_pool.h"
+#include "handle_pool/op_trace.h"
+
+TEST(OpTraceTest, RecordsPoolOperationsTest) {
+  handle_pool::OpTrace trace(16);
+  handle_pool::HandlePool<int> pool(2);
+  pool.SetTrace(&trace);
+
+  const handle_pool::Handle handle = pool.Create(1);
+  pool.Get(handle);
+  pool.Destroy(handle);
+  pool.Get(handle);
+  pool.SetTrace(nullptr);
+  pool.Create(2);
+
+  const std::vector<handle_pool::TraceRecord> records = trace.Records();
+  ASSERT_EQ(records.size(), 4);
+  EXPECT_EQ(records[0].op, handle_pool::TraceOp::kCreate);
+  EXPECT_EQ(records[1].op, handle_pool::TraceOp::kGet);
+  EXPECT_EQ(records[2].op, handle_pool::TraceOp::kDestroy);
+  EXPECT_EQ(records[3].op, handle_pool::TraceOp::kGetMiss);
+  for (const auto &record : records) {
+    EXPECT_EQ(handle_pool::Handle(record.index, record.generation), handle);
+    EXPECT_EQ(record.thread, records[0].thread);
+  }
+  EXPECT_LE(records[0].timestamp_ns, records[3].timestamp_ns);
+}
+
+TEST(OpTraceTest, DropsWhenFullTest) {
+  handle_pool::OpTrace trace(2);
+  for (uint32_t i = 0; i < 5; ++i) {
+    trace.Record(handle_pool::TraceOp::kGet, i, 0);
+  }
+  EXPECT_EQ(trace.Size(), 2);
+  EXPECT_EQ(trace.Dropped(), 3);
+  EXPECT_EQ(trace.Records()[1].index, 1);
+}
+
+TEST(OpTraceTest, FileRoundTripTest) {
+  const std::string path = ::testing::TempDir() + "op_trace_test.bin";
+  handle_pool::OpTrace trace(8);
+  trace.Record(handle_pool::TraceOp::kCreate, 3, 1);
+  trace.Record(handle_pool::TraceOp::kDestroy, 3, 1);
+  ASSERT_TRUE(trace.WriteFile(path));
+
+  const auto records = handle_pool::OpTrace::ReadFile(path);
+  ASSERT_TRUE(records.has_value());
+  ASSERT_EQ(records->size(), 2);
+  EXPECT_EQ((*records)[1].op, handle_pool::TraceOp::kDestroy);
+  EXPECT_EQ((*records)[1].index, 3);
+  EXPECT_EQ((*records)[1].generation, 1);
+
+  EXPECT_EQ(handle_pool::OpTrace::ReadFile(path + ".missing"), std::nullopt);
+  std::remove(path.c_str());
+}
+
+TEST(OpTraceTest, ReadFileChecksCountTest) {
+  const std::string path = ::testing::TempDir() + "op_trace_count.bin";
+  handle_pool::OpTrace trace(8);
+  trace.Record(handle_pool::TraceOp::kGet, 1, 0);
+  trace.Record(handle_pool::TraceOp::kGet, 2, 0);
+  ASSERT_TRUE(trace.WriteFile(path));
+
+  // Overwrite the record count that follows the magic.
+  for (const uint64_t count : {uint64_t{1}, uint64_t{3}, uint64_t{1} << 60}) {
+    std::FILE *file = std::fopen(path.c_str(), "r+b");
+    ASSERT_NE(file, nullptr);
+    std::fseek(file, 8, SEEK_SET);
+    std::fwrite(&count, sizeof(count), 1, file);
+    std::fclose(file);
+    EXPECT_EQ(handle_pool::OpTrace::ReadFile(path), std::nullopt);
+  }
+
+  // A record with an op outside TraceOp is rejected too.
+  ASSERT_TRUE(trace.WriteFile(path));
+  ASSERT_TRUE(handle_pool::OpTrace::ReadFile(path).has_value());
+  std::FILE *file = std::fopen(path.c_str(), "r+b");
+  ASSERT_NE(file, nullptr);
+  const uint8_t op = 200;
+  std::fseek(file, 16 + sizeof(handle_pool::TraceRecord) +
+                       offsetof(handle_pool::TraceRecord, op),
+             SEEK_SET);
+  std::fwrite(&op, sizeof(op), 1, file);
+  std::fclose(file);
+  EXPECT_EQ(handle_pool::OpTrace::ReadFile(path), std::nullopt);
+  std::remove(path.c_str());
+}
@@ -0,0 +1,153 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+#include "handle_pool/pool_budget.h"
+
+using Page = std::array<char, 4000>;
+using PagePool = handle_pool::HandlePool<Page>;
+
+TEST(PoolBudgetTest, GrowWithinBudgetTest) {
+  const size_t chunk = PagePool::ChunkCapacity();
+  handle_pool::PoolBudget budget(2 * PagePool::ChunkBytes());
+  PagePool pool(handle_pool::HandlePoolOptions{chunk, 4 * chunk});
+  EXPECT_TRUE(budget.Register(&pool));
+  EXPECT_FALSE(budget.Register(&pool));
+  EXPECT_EQ(budget.UsedBytes(), PagePool::ChunkBytes());
+
+  for (size_t i = 0; i < 2 * chunk; ++i) {
+    EXPECT_NE(pool.Create(), handle_pool::Handle::Invalid());
+  }
+  EXPECT_EQ(pool.Capacity(), 2 * chunk);
+  EXPECT_EQ(pool.Create(), handle_pool::Handle::Invalid());
+  EXPECT_EQ(budget.DeniedGrowths(), 1);
+
+  // Without the budget the pool grows up to its own maximum.
+  EXPECT_TRUE(budget.Unregister(&pool));
+  EXPECT_NE(pool.Create(), handle_pool::Handle::Invalid());
+  EXPECT_EQ(pool.Capacity(), 3 * chunk);
+}
+
+TEST(PoolBudgetTest, ReclaimFromIdlePoolTest) {
+  const size_t chunk = PagePool::ChunkCapacity();
+  handle_pool::PoolBudget budget(3 * PagePool::ChunkBytes());
+  PagePool busy(handle_pool::HandlePoolOptions{chunk, 3 * chunk});
+  PagePool idle(handle_pool::HandlePoolOptions{chunk, 3 * chunk});
+
+  std::vector<handle_pool::Handle> cached;
+  size_t pressure_calls = 0;
+  EXPECT_TRUE(budget.Register(&busy));
+  EXPECT_TRUE(budget.Register(&idle, [&](const size_t bytes_needed) {
+    EXPECT_EQ(bytes_needed, PagePool::ChunkBytes());
+    ++pressure_calls;
+    // Drop the cache so that its chunk can be released.
+    for (const auto &handle : cached) {
+      idle.Destroy(handle);
+    }
+    cached.clear();
+  }));
+
+  for (size_t i = 0; i < 2 * chunk; ++i) {
+    cached.push_back(idle.Create());
+  }
+  EXPECT_EQ(budget.UsedBytes(), 3 * PagePool::ChunkBytes());
+
+  for (size_t i = 0; i < 2 * chunk; ++i) {
+    EXPECT_NE(busy.Create(), handle_pool::Handle::Invalid());
+  }
+  EXPECT_EQ(pressure_calls, 1);
+  EXPECT_EQ(busy.Capacity(), 2 * chunk);
+  EXPECT_EQ(idle.Capacity(), chunk);
+  EXPECT_EQ(budget.UsedBytes(), 3 * PagePool::ChunkBytes());
+  EXPECT_EQ(budget.DeniedGrowths(), 0);
+
+  EXPECT_TRUE(budget.Unregister(&busy));
+  EXPECT_TRUE(budget.Unregister(&idle));
+}
+
+TEST(PoolBudgetTest, PressureCallbackMayUseBudgetTest) {
+  const size_t chunk = PagePool::ChunkCapacity();
+  handle_pool::PoolBudget budget(3 * PagePool::ChunkBytes());
+  PagePool busy(handle_pool::HandlePoolOptions{chunk, 2 * chunk});
+  PagePool idle(handle_pool::HandlePoolOptions{chunk, 2 * chunk});
+
+  std::vector<handle_pool::Handle> cached;
+  std::vector<size_t> used_seen;
+  EXPECT_TRUE(budget.Register(&busy));
+  EXPECT_TRUE(budget.Register(&idle, [&](size_t) {
+    // The budget's mutex is not held here.
+    used_seen.push_back(budget.UsedBytes());
+    for (const auto &handle : cached) {
+      idle.Destroy(handle);
+    }
+    cached.clear();
+  }));
+  for (size_t i = 0; i < chunk + 1; ++i) {
+    cached.push_back(idle.Create());
+  }
+  ASSERT_EQ(idle.Capacity(), 2 * chunk);
+  ASSERT_EQ(budget.DeniedGrowths(), 0);
+
+  for (size_t i = 0; i < chunk + 1; ++i) {
+    EXPECT_NE(busy.Create(), handle_pool::Handle::Invalid());
+  }
+  ASSERT_EQ(used_seen.size(), 1);
+  EXPECT_EQ(used_seen[0], 3 * PagePool::ChunkBytes());
+  EXPECT_EQ(busy.Capacity(), 2 * chunk);
+  EXPECT_EQ(idle.Capacity(), chunk);
+  EXPECT_EQ(budget.DeniedGrowths(), 0);
+
+  EXPECT_TRUE(budget.Unregister(&busy));
+  EXPECT_TRUE(budget.Unregister(&idle));
+}
+
+TEST(PoolBudgetTest, UnregisterWaitsForReclaimTest) {
+  const size_t chunk = PagePool::ChunkCapacity();
+  handle_pool::PoolBudget budget(3 * PagePool::ChunkBytes());
+  PagePool busy(handle_pool::HandlePoolOptions{chunk, 2 * chunk});
+  PagePool idle(handle_pool::HandlePoolOptions{chunk, 2 * chunk});
+
+  std::vector<handle_pool::Handle> cached;
+  std::atomic<bool> in_callback{false}, release{false}, unregistered{false};
+  EXPECT_TRUE(budget.Register(&busy));
+  EXPECT_TRUE(budget.Register(&idle, [&](size_t) {
+    in_callback = true;
+    while (!release) {
+      std::this_thread::yield();
+    }
+    for (const auto &handle : cached) {
+      idle.Destroy(handle);
+    }
+    cached.clear();
+  }));
+  for (size_t i = 0; i < chunk + 1; ++i) {
+    cached.push_back(idle.Create());
+  }
+  ASSERT_EQ(idle.Capacity(), 2 * chunk);
+
+  std::thread grower([&] {
+    for (size_t i = 0; i < chunk + 1; ++i) {
+      EXPECT_NE(busy.Create(), handle_pool::Handle::Invalid());
+    }
+  });
+  while (!in_callback) {
+    std::this_thread::yield();
+  }
+  // The reclaim is calling into `idle`, so unregistering it has to wait.
+  std::thread unregisterer([&] {
+    EXPECT_TRUE(budget.Unregister(&idle));
+    unregistered = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(unregistered);
+  release = true;
+  grower.join();
+  unregisterer.join();
+  EXPECT_TRUE(unregistered);
+  EXPECT_EQ(busy.Capacity(), 2 * chunk);
+  EXPECT_EQ(idle.Capacity(), chunk);
+  EXPECT_TRUE(budget.Unregister(&busy));
+}
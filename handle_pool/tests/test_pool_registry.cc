@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include <optional>
+#include <string>
+
+#include "handle_pool/pool_registry.h"
+
+struct Sound {
+  std::string name;
+};
+
+TEST(PoolRegistryTest, AnyHandlePackTest) {
+  const handle_pool::AnyHandle handle(7, 0x123456, 42);
+  const uint64_t word = handle.Pack();
+  EXPECT_EQ(handle_pool::AnyHandle::Unpack(word), handle);
+  EXPECT_EQ(handle.ToHandle(), handle_pool::Handle(0x123456, 42));
+  EXPECT_NE(handle_pool::AnyHandle::Invalid(), handle);
+}
+
+TEST(PoolRegistryTest, ResolveTest) {
+  handle_pool::PoolRegistry registry;
+  handle_pool::HandlePool<int> ints(4);
+  handle_pool::HandlePool<Sound> sounds(4);
+
+  const auto int_pool = registry.Register(&ints);
+  const auto sound_pool = registry.Register(&sounds);
+  ASSERT_TRUE(int_pool.has_value());
+  ASSERT_TRUE(sound_pool.has_value());
+  EXPECT_NE(*int_pool, *sound_pool);
+
+  const handle_pool::AnyHandle i = registry.Create<int>(*int_pool, 5);
+  const handle_pool::AnyHandle s =
+      registry.Wrap(*sound_pool, sounds.Create(Sound{"bell"}));
+  EXPECT_EQ(i.pool_id, *int_pool);
+
+  EXPECT_EQ(registry.Resolve<int>(i).value().get(), 5);
+  EXPECT_EQ(registry.Resolve<Sound>(s).value().get().name, "bell");
+  // The element type is checked.
+  EXPECT_EQ(registry.Resolve<Sound>(i), std::nullopt);
+  EXPECT_TRUE(registry.Holds<int>(i));
+  EXPECT_FALSE(registry.Holds<int>(s));
+  EXPECT_EQ(registry.Create<Sound>(*int_pool, Sound{"x"}),
+            handle_pool::AnyHandle::Invalid());
+  EXPECT_EQ(registry.Resolve<int>(handle_pool::AnyHandle::Invalid()),
+            std::nullopt);
+}
+
+TEST(PoolRegistryTest, UntypedDestroyTest) {
+  handle_pool::PoolRegistry registry;
+  handle_pool::HandlePool<Sound> sounds(2);
+  const uint8_t id = registry.Register(&sounds).value();
+
+  const handle_pool::AnyHandle s = registry.Create<Sound>(id, Sound{"horn"});
+  EXPECT_TRUE(registry.IsValid(s));
+  EXPECT_TRUE(registry.Destroy(s));
+  EXPECT_FALSE(registry.IsValid(s));
+  EXPECT_FALSE(registry.Destroy(s));
+  EXPECT_TRUE(sounds.Empty());
+
+  EXPECT_TRUE(registry.Unregister(id));
+  EXPECT_FALSE(registry.Unregister(id));
+  EXPECT_EQ(registry.PoolAs<Sound>(id), nullptr);
+}
+
+TEST(PoolRegistryTest, RegistryFullTest) {
+  handle_pool::PoolRegistry registry;
+  handle_pool::HandlePool<int> pool(1);
+  for (size_t i = 0; i < handle_pool::PoolRegistry::kMaxPools; ++i) {
+    EXPECT_EQ(registry.Register(&pool), i);
+  }
+  EXPECT_EQ(registry.Register(&pool), std::nullopt);
+}
@@ -0,0 +1,165 @@
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "handle_pool/tiered_handle_pool.h"
+
+struct Record {
+  int id;
+  double value;
+};
+
+std::string SpillPath(const std::string &name) {
+  return testing::TempDir() + "/" + name + ".spill";
+}
+
+TEST(TieredHandlePoolTest, SpillsAndFaultsBackInTest) {
+  handle_pool::TieredHandlePool<Record> pool(8, 2, SpillPath("spill"));
+  ASSERT_TRUE(pool.HasSpillFile());
+
+  std::vector<handle_pool::Handle> handles;
+  for (int i = 0; i < 8; ++i) {
+    handles.push_back(pool.Create(Record{i, i * 1.5}));
+    ASSERT_TRUE(pool.IsValid(handles.back()));
+  }
+  EXPECT_EQ(pool.Free(), 0);
+  EXPECT_FALSE(pool.IsResident(handles[0]));
+
+  // Every object is readable regardless of tier.
+  for (int i = 0; i < 8; ++i) {
+    auto record = pool.Get(handles[i]);
+    ASSERT_TRUE(record.has_value());
+    EXPECT_EQ(record->id, i);
+    EXPECT_EQ(record->value, i * 1.5);
+    EXPECT_TRUE(pool.IsResident(handles[i]));
+  }
+}
+
+TEST(TieredHandlePoolTest, ModifySurvivesEvictionTest) {
+  handle_pool::TieredHandlePool<Record> pool(4, 1, SpillPath("modify"));
+
+  const handle_pool::Handle handle1 = pool.Create(Record{1, 0});
+  EXPECT_TRUE(pool.Modify(handle1, [](Record &r) { r.value = 42; }));
+
+  // Creating another object evicts handle1 from the only frame.
+  const handle_pool::Handle handle2 = pool.Create(Record{2, 0});
+  EXPECT_FALSE(pool.IsResident(handle1));
+  EXPECT_TRUE(pool.IsResident(handle2));
+
+  EXPECT_EQ(pool.Get(handle1)->value, 42);
+  EXPECT_FALSE(pool.IsResident(handle2));
+}
+
+TEST(TieredHandlePoolTest, PrefetchTest) {
+  handle_pool::TieredHandlePool<Record> pool(4, 1, SpillPath("prefetch"));
+
+  const handle_pool::Handle handle1 = pool.Create(Record{1, 0});
+  pool.Create(Record{2, 0});
+  ASSERT_FALSE(pool.IsResident(handle1));
+
+  EXPECT_TRUE(pool.Prefetch(handle1).get());
+  EXPECT_TRUE(pool.IsResident(handle1));
+  EXPECT_FALSE(pool.Prefetch(handle_pool::Handle::Invalid()).get());
+}
+
+TEST(TieredHandlePoolTest, PrefetchQueueDrainsTest) {
+  auto pool = std::make_unique<handle_pool::TieredHandlePool<Record>>(
+      64, 4, SpillPath("prefetch_queue"));
+  std::vector<handle_pool::Handle> handles;
+  for (int i = 0; i < 64; ++i) {
+    handles.push_back(pool->Create(Record{i, 0}));
+  }
+
+  // Many prefetches share the one prefetch thread; dropped futures are
+  // fine, and destroying the pool finishes the queued ones.
+  std::vector<std::future<bool>> kept;
+  for (size_t i = 0; i < handles.size(); ++i) {
+    std::future<bool> done = pool->Prefetch(handles[i]);
+    if (i % 8 == 0) {
+      kept.push_back(std::move(done));
+    }
+  }
+  pool.reset();
+  for (std::future<bool> &done : kept) {
+    EXPECT_TRUE(done.get());
+  }
+}
+
+TEST(TieredHandlePoolTest, DestroySpilledTest) {
+  handle_pool::TieredHandlePool<Record> pool(2, 1, SpillPath("destroy"));
+
+  const handle_pool::Handle handle1 = pool.Create(Record{1, 0});
+  const handle_pool::Handle handle2 = pool.Create(Record{2, 0});
+  ASSERT_FALSE(pool.IsResident(handle1));
+
+  EXPECT_TRUE(pool.Destroy(handle1));
+  EXPECT_FALSE(pool.IsValid(handle1));
+  EXPECT_EQ(pool.Get(handle1), std::nullopt);
+  EXPECT_FALSE(pool.Destroy(handle1));
+
+  const handle_pool::Handle handle3 = pool.Create(Record{3, 0});
+  EXPECT_EQ(handle1.index, handle3.index);
+  EXPECT_NE(handle1.generation, handle3.generation);
+  EXPECT_EQ(pool.Get(handle2)->id, 2);
+  EXPECT_EQ(pool.Get(handle3)->id, 3);
+}
+
+struct Fragile {
+  explicit Fragile(const int id) : id(id) {
+    if (id < 0) {
+      throw std::invalid_argument("negative id");
+    }
+  }
+  int id;
+};
+
+TEST(TieredHandlePoolTest, ThrowingConstructorTest) {
+  handle_pool::TieredHandlePool<Fragile> pool(2, 1, SpillPath("throwing"));
+
+  EXPECT_EQ(pool.Create(-1), handle_pool::Handle::Invalid());
+  EXPECT_TRUE(pool.Empty());
+  // Neither the slot nor the frame leaked.
+  const handle_pool::Handle handle1 = pool.Create(1);
+  const handle_pool::Handle handle2 = pool.Create(2);
+  EXPECT_NE(handle2, handle_pool::Handle::Invalid());
+  EXPECT_EQ(pool.Get(handle1)->id, 1);
+  EXPECT_EQ(pool.Get(handle2)->id, 2);
+}
+
+TEST(TieredHandlePoolTest, ConcurrentFaultsTest) {
+  handle_pool::TieredHandlePool<Record> pool(64, 4, SpillPath("concurrent"));
+  std::vector<handle_pool::Handle> handles;
+  for (int i = 0; i < 64; ++i) {
+    handles.push_back(pool.Create(Record{i, 0}));
+  }
+
+  // Spill I/O runs outside the lock; every thread still sees its own
+  // updates and every object its own bytes.
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      for (int round = 0; round < 50; ++round) {
+        for (int i = t; i < 64; i += 4) {
+          pool.Prefetch(handles[(i + 7) % 64]);
+          ASSERT_TRUE(pool.Modify(handles[i], [](Record &r) { ++r.value; }));
+          const std::optional<Record> record = pool.Get(handles[i]);
+          ASSERT_TRUE(record.has_value());
+          EXPECT_EQ(record->id, i);
+          EXPECT_EQ(record->value, round + 1);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (int i = 0; i < 64; ++i) {
+    EXPECT_TRUE(pool.Destroy(handles[i]));
+  }
+  EXPECT_TRUE(pool.Empty());
+}
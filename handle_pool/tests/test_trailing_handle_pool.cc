@@ -0,0 +1,70 @@
+#include <cstddef>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <optional>
+
+#include "handle_pool/trailing_handle_pool.h"
+
+struct Header {
+  int type;
+};
+
+using MessagePool = handle_pool::TrailingHandlePool<Header, 1000>;
+
+TEST(TrailingHandlePoolTest, SizeClassesTest) {
+  EXPECT_EQ(MessagePool::kClassCount, 5);
+  EXPECT_EQ(MessagePool::ClassBytes(0), 64);
+  EXPECT_EQ(MessagePool::ClassBytes(3), 512);
+  EXPECT_EQ(MessagePool::ClassBytes(4), 1000);
+}
+
+TEST(TrailingHandlePoolTest, CreateWithTrailingTest) {
+  MessagePool pool(2);
+  EXPECT_TRUE(pool.Empty());
+
+  const handle_pool::Handle small = pool.CreateWithTrailing(10, Header{1});
+  const handle_pool::Handle large = pool.CreateWithTrailing(900, Header{2});
+  EXPECT_TRUE(pool.IsValid(small));
+  EXPECT_TRUE(pool.IsValid(large));
+  EXPECT_EQ(pool.Free(10), 1);
+  EXPECT_EQ(pool.Free(900), 1);
+  EXPECT_EQ(pool.Free(200), 2);
+
+  auto bytes = pool.Trailing(large);
+  ASSERT_TRUE(bytes.has_value());
+  EXPECT_EQ(bytes->size, 900);
+  EXPECT_EQ(bytes->data[899], std::byte{0});
+  std::memset(bytes->data, 0x5a, bytes->size);
+
+  EXPECT_EQ(pool.Get(small).value().get().type, 1);
+  EXPECT_EQ(pool.Get(large).value().get().type, 2);
+  EXPECT_EQ(pool.Trailing(small)->size, 10);
+  EXPECT_EQ((*pool.Trailing(large))[0], std::byte{0x5a});
+
+  EXPECT_EQ(pool.CreateWithTrailing(1001, Header{3}),
+            handle_pool::Handle::Invalid());
+  EXPECT_EQ(pool.Get(handle_pool::Handle::Invalid()), std::nullopt);
+}
+
+TEST(TrailingHandlePoolTest, DestroyAndReuseTest) {
+  MessagePool pool(1);
+
+  const handle_pool::Handle handle1 = pool.CreateWithTrailing(100, Header{1});
+  EXPECT_EQ(pool.CreateWithTrailing(120, Header{2}),
+            handle_pool::Handle::Invalid());
+  // Other size classes are unaffected.
+  const handle_pool::Handle handle2 = pool.Create(Header{3});
+  EXPECT_EQ(pool.Trailing(handle2)->size, 0);
+
+  EXPECT_TRUE(pool.Destroy(handle1));
+  EXPECT_FALSE(pool.IsValid(handle1));
+  EXPECT_EQ(pool.Trailing(handle1), std::nullopt);
+  EXPECT_FALSE(pool.Destroy(handle1));
+
+  const handle_pool::Handle handle3 = pool.CreateWithTrailing(128, Header{4});
+  EXPECT_EQ(handle1.index, handle3.index);
+  EXPECT_NE(handle1.generation, handle3.generation);
+  EXPECT_TRUE(pool.Destroy(handle2));
+  EXPECT_TRUE(pool.Destroy(handle3));
+  EXPECT_TRUE(pool.Empty());
+}
@@ -0,0 +1,87 @@
+#include <atomic>
+#include <gtest/gtest.h>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "handle_pool/versioned_handle_pool.h"
+
+struct Pair {
+  int a;
+  int b;
+};
+
+TEST(VersionedHandlePoolTest, BasicFunctionalityTest) {
+  handle_pool::VersionedHandlePool<Pair> pool(2);
+  EXPECT_TRUE(pool.Empty());
+
+  const handle_pool::Handle handle1 = pool.Create(Pair{1, 1});
+  EXPECT_TRUE(pool.IsValid(handle1));
+  EXPECT_EQ(pool.Load(handle1)->a, 1);
+
+  EXPECT_TRUE(pool.Update(handle1, [](Pair &p) { p.a = p.b = 2; }));
+  EXPECT_EQ(pool.Load(handle1)->b, 2);
+
+  EXPECT_TRUE(pool.Destroy(handle1));
+  EXPECT_FALSE(pool.IsValid(handle1));
+  EXPECT_EQ(pool.Load(handle1), std::nullopt);
+  EXPECT_FALSE(pool.Update(handle1, [](Pair &) {}));
+  EXPECT_FALSE(pool.Destroy(handle1));
+
+  const handle_pool::Handle handle2 = pool.Create(Pair{3, 3});
+  const handle_pool::Handle handle3 = pool.Create(Pair{4, 4});
+  EXPECT_EQ(pool.Create(Pair{5, 5}), handle_pool::Handle::Invalid());
+  EXPECT_EQ(pool.Load(handle2)->a, 3);
+  EXPECT_EQ(pool.Load(handle3)->a, 4);
+}
+
+TEST(VersionedHandlePoolTest, ReaderKeepsItsVersionTest) {
+  handle_pool::VersionedHandlePool<Pair> pool(1, 1);
+  const handle_pool::Handle handle1 = pool.Create(Pair{1, 1});
+
+  EXPECT_TRUE(pool.Read(handle1, [&](const Pair &old) {
+    EXPECT_TRUE(pool.Update(handle1, [](Pair &p) { p.a = p.b = 2; }));
+    // The reader still sees its version; new readers see the update.
+    EXPECT_EQ(old.a, 1);
+    EXPECT_EQ(pool.Load(handle1)->a, 2);
+    // The old version cannot be reclaimed while we read it, so there is no
+    // spare version for another update.
+    EXPECT_EQ(pool.Reclaim(), 0);
+    EXPECT_FALSE(pool.Update(handle1, [](Pair &) {}));
+  }));
+
+  EXPECT_EQ(pool.Reclaim(), 1);
+  EXPECT_TRUE(pool.Update(handle1, [](Pair &p) { p.a = p.b = 3; }));
+  EXPECT_EQ(pool.Load(handle1)->b, 3);
+}
+
+TEST(VersionedHandlePoolTest, ConcurrentReadersSeeConsistentObjectsTest) {
+  handle_pool::VersionedHandlePool<Pair> pool(1, 8);
+  const handle_pool::Handle handle1 = pool.Create(Pair{0, 0});
+
+  std::atomic<bool> done{false};
+  std::atomic<int> torn{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&] {
+      while (!done) {
+        pool.Read(handle1, [&](const Pair &p) {
+          if (p.a != p.b) {
+            ++torn;
+          }
+        });
+      }
+    });
+  }
+  for (int i = 1; i <= 2000; ++i) {
+    while (!pool.Update(handle1, [i](Pair &p) { p.a = p.b = i; })) {
+      std::this_thread::yield();
+    }
+  }
+  done = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(torn, 0);
+  EXPECT_EQ(pool.Load(handle1)->a, 2000);
+}
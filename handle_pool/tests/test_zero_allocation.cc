@@ -0,0 +1,119 @@
+#include <array>
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+#include "handle_pool/handle_pool.h"
+#include "handle_pool/op_trace.h"
+#include "handle_pool/testing/allocation_counter.h"
+
+using handle_pool::testing::ScopedAllocationCounter;
+
+namespace {
+
+struct Payload {
+  explicit Payload(int v) : value(v) {}
+  int value;
+  std::array<char, 60> bytes{};
+};
+
+// Runs `rounds` of creating up to `live` objects, reading them and
+// destroying them, plus misses with stale handles. Handles are kept packed
+// in caller-owned storage so the loop itself does not allocate.
+void Churn(handle_pool::HandlePool<Payload> &pool, std::vector<uint64_t> &slots,
+           const size_t live, const int rounds) {
+  for (int round = 0; round < rounds; ++round) {
+    for (size_t i = 0; i < live; ++i) {
+      slots[i] = pool.Create(round).Pack();
+    }
+    for (size_t i = 0; i < live; ++i) {
+      const handle_pool::Handle handle = handle_pool::Handle::Unpack(slots[i]);
+      EXPECT_EQ(pool.Get(handle).value().get().value, round);
+      const auto &const_pool = pool;
+      EXPECT_TRUE(const_pool.Get(handle).has_value());
+    }
+    for (size_t i = 0; i < live; ++i) {
+      EXPECT_TRUE(pool.Destroy(handle_pool::Handle::Unpack(slots[i])));
+    }
+    EXPECT_FALSE(pool.Get(handle_pool::Handle::Unpack(slots[0])).has_value());
+    EXPECT_FALSE(pool.Destroy(handle_pool::Handle::Unpack(slots[0])));
+  }
+}
+
+} // namespace
+
+TEST(ZeroAllocationTest, CounterSeesAllocationsTest) {
+  ScopedAllocationCounter counter;
+  auto p = std::make_unique<int>(1);
+  std::vector<int> v(100);
+  EXPECT_EQ(counter.Allocations(), 2);
+  EXPECT_GE(counter.Bytes(), sizeof(int) + 100 * sizeof(int));
+}
+
+TEST(ZeroAllocationTest, FixedPoolTest) {
+  handle_pool::HandlePool<Payload> pool(256);
+  std::vector<uint64_t> slots(256);
+
+  ScopedAllocationCounter counter;
+  Churn(pool, slots, 256, 4);
+  // Create on a full pool fails without allocating.
+  for (size_t i = 0; i < 256; ++i) {
+    slots[i] = pool.Create(0).Pack();
+  }
+  EXPECT_EQ(pool.Create(0), handle_pool::Handle::Invalid());
+  EXPECT_EQ(counter.Allocations(), 0);
+}
+
+TEST(ZeroAllocationTest, GrownPoolTest) {
+  const size_t chunk = handle_pool::HandlePool<Payload>::ChunkCapacity();
+  handle_pool::HandlePoolOptions options;
+  options.initial_capacity = chunk;
+  options.max_capacity = 4 * chunk;
+  options.auto_size = true;
+  handle_pool::HandlePool<Payload> pool(options);
+  std::vector<uint64_t> slots(4 * chunk);
+
+  // Growing allocates chunks, so fill the pool to its maximum first.
+  for (size_t i = 0; i < 4 * chunk; ++i) {
+    slots[i] = pool.Create(0).Pack();
+  }
+  ASSERT_EQ(pool.Capacity(), 4 * chunk);
+
+  // From here on, neither emptying the grown pool nor churning it (busy
+  // enough not to shrink) may allocate.
+  ScopedAllocationCounter counter;
+  for (size_t i = 0; i < 4 * chunk; ++i) {
+    EXPECT_TRUE(pool.Destroy(handle_pool::Handle::Unpack(slots[i])));
+  }
+  EXPECT_EQ(counter.Allocations(), 0);
+  Churn(pool, slots, 3 * chunk, 4);
+  EXPECT_EQ(pool.Capacity(), 4 * chunk);
+  EXPECT_EQ(counter.Allocations(), 0);
+}
+
+TEST(ZeroAllocationTest, TracedTenantPoolTest) {
+  handle_pool::HandlePoolOptions options;
+  options.initial_capacity = 64;
+  options.max_tenants = 2;
+  handle_pool::HandlePool<Payload> pool(options);
+  ASSERT_TRUE(pool.SetTenantQuota(handle_pool::TenantId(0), {8, 32}));
+  handle_pool::OpTrace trace(1 << 16);
+  pool.SetTrace(&trace);
+  std::vector<uint64_t> slots(32);
+
+  ScopedAllocationCounter counter;
+  for (int round = 0; round < 4; ++round) {
+    for (size_t i = 0; i < 32; ++i) {
+      slots[i] = pool.Create(handle_pool::TenantId(0), round).Pack();
+    }
+    EXPECT_EQ(pool.Create(handle_pool::TenantId(0), 0),
+              handle_pool::Handle::Invalid());
+    for (size_t i = 0; i < 32; ++i) {
+      EXPECT_TRUE(pool.Destroy(handle_pool::Handle::Unpack(slots[i])));
+    }
+  }
+  Churn(pool, slots, 32, 2);
+  EXPECT_EQ(counter.Allocations(), 0);
+  EXPECT_GT(trace.Size(), 0);
+  pool.SetTrace(nullptr);
+}
@@ -0,0 +1,499 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fcntl.h>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "handle_pool/handle_pool.h"
+#include "rwlock/rw_lock.h"
+#include "rwlock/shared_lock.h"
+#include "rwlock/unique_lock.h"
+
+namespace handle_pool {
+
+/*
+ * A pool of trivially copyable T that keeps at most `resident_capacity`
+ * objects in memory and spills the rest to a local file.
+ *
+ * Every slot carries a tier bit. When a resident frame is needed and none is
+ * free, a clock sweep over the frames evicts the first object that has not
+ * been accessed since the hand last passed it: its bytes are written to the
+ * spill file at `index * sizeof(T)` and the slot is marked spilled. `Get`,
+ * `Modify` and `Prefetch` fault spilled objects back in. Handles are the same
+ * regardless of tier.
+ *
+ * `Get` returns a copy, since a reference into a frame would not survive the
+ * frame being evicted by another caller; use `Modify` to update in place.
+ *
+ * If the spill file cannot be opened the pool works as a plain pool of
+ * `resident_capacity` objects (see `HasSpillFile`).
+ *
+ * Thread-safety:
+ * - `Create`, `Destroy`, fault-ins and evictions update the pool under an
+ * exclusive lock but read and write the spill file without it. While its
+ * bytes are in flight an object is in transit: operations on it wait for
+ * the I/O to finish, and the clock hand passes over its frame. If every
+ * frame is in transit, `Create` and fault-ins wait for one.
+ * - `Get` and `Modify` of resident objects use a shared lock.
+ * - `Prefetch` queues work for a single prefetch thread, started by the
+ * first call.
+ */
+template <typename T> class TieredHandlePool {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "TieredHandlePool spills raw bytes; T must be trivially "
+                "copyable");
+
+public:
+  TieredHandlePool(const size_t capacity, const size_t resident_capacity,
+                   const std::string &spill_path)
+      : capacity_(capacity), resident_capacity_(resident_capacity),
+        spill_path_(spill_path) {
+    assert(capacity_ > 0);
+    assert(resident_capacity_ > 0 && resident_capacity_ <= capacity_);
+    slots_.resize(capacity_);
+    frames_.resize(resident_capacity_);
+    free_list_.reserve(capacity_);
+    for (uint32_t i = 0; i < capacity_; ++i) {
+      free_list_.push_back(i);
+    }
+    free_frames_.reserve(resident_capacity_);
+    for (uint32_t i = 0; i < resident_capacity_; ++i) {
+      free_frames_.push_back(i);
+    }
+    fd_ = ::open(spill_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 0600);
+  }
+
+  // Finishes queued prefetches, then closes and removes the spill file.
+  ~TieredHandlePool() {
+    {
+      std::lock_guard<std::mutex> l(prefetch_mutex_);
+      stopping_ = true;
+    }
+    prefetch_ready_.notify_one();
+    if (prefetcher_.joinable()) {
+      prefetcher_.join();
+    }
+    rwlock::UniqueLock ul(rwlock_);
+    if (fd_ >= 0) {
+      ::close(fd_);
+      ::unlink(spill_path_.c_str());
+    }
+  }
+
+  // Creates a new resident T, evicting a cold object if all frames are used.
+  // Returns Handle::Invalid() if the pool is full, no frame can be freed or
+  // T's constructor throws.
+  template <typename... Args> const Handle Create(Args &&...args) {
+    {
+      rwlock::SharedLock l(rwlock_);
+      if (free_list_.empty()) {
+        return Handle::Invalid();
+      }
+    }
+    const std::optional<uint32_t> frame = AcquireFrame();
+    if (!frame.has_value()) {
+      return Handle::Invalid();
+    }
+    rwlock::UniqueLock l(rwlock_);
+
+    if (free_list_.empty()) {
+      ReleaseFrame(*frame);
+      return Handle::Invalid();
+    }
+    const uint32_t index = free_list_.back();
+    free_list_.pop_back();
+
+    try {
+      new (&frames_[*frame].storage) T(std::forward<Args>(args)...);
+    } catch (...) {
+      // If constructor throws, put the slot and the frame back.
+      free_list_.push_back(index);
+      ReleaseFrame(*frame);
+      return Handle::Invalid();
+    }
+    frames_[*frame].slot = index;
+
+    Slot &slot = slots_[index];
+    slot.frame = *frame;
+    slot.in_use = true;
+    slot.tier = Tier::kResident;
+    slot.referenced.store(true, std::memory_order_relaxed);
+    return Handle{index, slot.generation};
+  }
+
+  // Destroy the T associated with the handle, in whichever tier it lives.
+  // Waits if the object is in transit.
+  bool Destroy(const Handle &handle) {
+    for (;;) {
+      {
+        rwlock::UniqueLock l(rwlock_);
+
+        if (!IsValidInternal(handle)) {
+          return false;
+        }
+        Slot &slot = slots_[handle.index];
+        if (slot.tier == Tier::kResident || slot.tier == Tier::kSpilled) {
+          if (slot.tier == Tier::kResident) {
+            ReleaseFrame(slot.frame);
+          }
+          slot.in_use = false;
+          slot.tier = Tier::kResident;
+          ++slot.generation;
+          free_list_.push_back(handle.index);
+          return true;
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  // Returns a copy of the T if the handle is valid, faulting it in from the
+  // spill file if needed; nullopt if the handle is stale or the read failed.
+  std::optional<T> Get(const Handle &handle) {
+    std::optional<T> result;
+    auto copy = [&](T &obj) { result = obj; };
+    Access(handle, copy);
+    return result;
+  }
+
+  // Calls fn(T &) on the object, faulting it in if needed. Returns false if
+  // the handle is stale or the object could not be read back.
+  template <typename Fn> bool Modify(const Handle &handle, Fn &&fn) {
+    return Access(handle, fn);
+  }
+
+  // Queues the object to be faulted in by the prefetch thread and returns
+  // at once; the future may be dropped without waiting for it. It yields
+  // true once the object is resident. Throws std::system_error if the
+  // prefetch thread cannot be started.
+  std::future<bool> Prefetch(const Handle &handle) {
+    std::packaged_task<bool()> task(
+        [this, index = handle.index, generation = handle.generation] {
+          auto touch = [](T &) {};
+          return Access(Handle{index, generation}, touch);
+        });
+    std::future<bool> result = task.get_future();
+    {
+      std::lock_guard<std::mutex> l(prefetch_mutex_);
+      if (!prefetcher_.joinable()) {
+        prefetcher_ = std::thread([this] { RunPrefetches(); });
+      }
+      prefetch_queue_.push_back(std::move(task));
+    }
+    prefetch_ready_.notify_one();
+    return result;
+  }
+
+  // Checks if a given handle is still valid.
+  bool IsValid(const Handle &handle) {
+    rwlock::SharedLock l(rwlock_);
+    return IsValidInternal(handle);
+  }
+
+  // Returns true if the handle is valid and its object is in memory.
+  bool IsResident(const Handle &handle) {
+    rwlock::SharedLock l(rwlock_);
+    return IsValidInternal(handle) &&
+           slots_[handle.index].tier == Tier::kResident;
+  }
+
+  inline constexpr size_t Capacity() const { return capacity_; }
+
+  inline constexpr size_t ResidentCapacity() const {
+    return resident_capacity_;
+  }
+
+  // Returns true if objects can be spilled to disk.
+  bool HasSpillFile() const { return fd_ >= 0; }
+
+  // Returns true if there are no currently used slots.
+  bool Empty() {
+    rwlock::SharedLock l(rwlock_);
+    return (free_list_.size() == capacity_);
+  }
+
+  // Returns how many free slots remain.
+  size_t Free() {
+    rwlock::SharedLock l(rwlock_);
+    return free_list_.size();
+  }
+
+  // Disallow copy (owning resource).
+  TieredHandlePool(const TieredHandlePool &) = delete;
+  TieredHandlePool &operator=(const TieredHandlePool &) = delete;
+
+private:
+  // Where a slot's object is. Objects in transit are neither read nor
+  // destroyed until their I/O completes.
+  enum class Tier : uint8_t {
+    kResident,
+    // In the spill file, not in a frame.
+    kSpilled,
+    // Still in its frame, being written to the spill file.
+    kSpilling,
+    // Being read from the spill file into a frame.
+    kLoading,
+  };
+
+  // Frame::slot of a frame that holds no object.
+  static constexpr uint32_t kNoSlot = std::numeric_limits<uint32_t>::max();
+
+  struct Slot {
+    uint32_t generation = 0;
+    // Frame holding the object while it is resident.
+    uint32_t frame = 0;
+    bool in_use = false;
+    Tier tier = Tier::kResident;
+    // Set on access, cleared by the clock hand.
+    std::atomic<bool> referenced{false};
+
+    Slot() = default;
+    Slot(const Slot &other)
+        : generation(other.generation), frame(other.frame),
+          in_use(other.in_use), tier(other.tier),
+          referenced(other.referenced.load(std::memory_order_relaxed)) {}
+  };
+
+  struct Frame {
+    alignas(T) unsigned char storage[sizeof(T)];
+    // Slot whose object this frame holds, or kNoSlot.
+    uint32_t slot = kNoSlot;
+  };
+
+  // Runs fn on the resident object, taking the exclusive lock only if the
+  // object has to be faulted in first.
+  template <typename Fn> bool Access(const Handle &handle, Fn &fn) {
+    for (;;) {
+      {
+        rwlock::SharedLock l(rwlock_);
+        if (!IsValidInternal(handle)) {
+          return false;
+        }
+        Slot &slot = slots_[handle.index];
+        if (slot.tier == Tier::kResident) {
+          slot.referenced.store(true, std::memory_order_relaxed);
+          fn(*reinterpret_cast<T *>(&frames_[slot.frame].storage));
+          return true;
+        }
+      }
+      const std::optional<bool> done = FaultIn(handle, fn);
+      if (done.has_value()) {
+        return *done;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  // Reads a spilled object back into a frame and runs fn on it. Returns
+  // false if the handle is stale or the read failed, and nullopt if the
+  // object is in transit.
+  template <typename Fn>
+  std::optional<bool> FaultIn(const Handle &handle, Fn &fn) {
+    {
+      rwlock::UniqueLock l(rwlock_);
+      if (!IsValidInternal(handle)) {
+        return false;
+      }
+      Slot &slot = slots_[handle.index];
+      if (slot.tier == Tier::kResident) {
+        slot.referenced.store(true, std::memory_order_relaxed);
+        fn(*reinterpret_cast<T *>(&frames_[slot.frame].storage));
+        return true;
+      }
+      if (slot.tier != Tier::kSpilled) {
+        return std::nullopt;
+      }
+      slot.tier = Tier::kLoading;
+    }
+
+    // The frame is ours alone and the slot cannot change while it loads.
+    const std::optional<uint32_t> frame = AcquireFrame();
+    const bool loaded = frame.has_value() &&
+                        ReadAll(frames_[*frame].storage, Offset(handle.index));
+
+    rwlock::UniqueLock l(rwlock_);
+    Slot &slot = slots_[handle.index];
+    if (!loaded) {
+      if (frame.has_value()) {
+        ReleaseFrame(*frame);
+      }
+      slot.tier = Tier::kSpilled;
+      return false;
+    }
+    frames_[*frame].slot = handle.index;
+    slot.frame = *frame;
+    slot.tier = Tier::kResident;
+    slot.referenced.store(true, std::memory_order_relaxed);
+    fn(*reinterpret_cast<T *>(&frames_[*frame].storage));
+    return true;
+  }
+
+  // Body of the prefetch thread: runs queued prefetches until the pool is
+  // destroyed and the queue has drained.
+  void RunPrefetches() {
+    std::unique_lock<std::mutex> l(prefetch_mutex_);
+    for (;;) {
+      prefetch_ready_.wait(
+          l, [this] { return stopping_ || !prefetch_queue_.empty(); });
+      if (prefetch_queue_.empty()) {
+        return;
+      }
+      std::packaged_task<bool()> task = std::move(prefetch_queue_.front());
+      prefetch_queue_.pop_front();
+      l.unlock();
+      // Exceptions end up in the task's future.
+      task();
+      l.lock();
+    }
+  }
+
+  // Returns a frame for the caller's sole use, evicting the coldest
+  // resident object if none is free. Takes the exclusive lock itself and
+  // writes the evicted object out without it.
+  std::optional<uint32_t> AcquireFrame() {
+    uint32_t frame = kNoSlot;
+    uint32_t victim = kNoSlot;
+    for (;;) {
+      {
+        rwlock::UniqueLock l(rwlock_);
+        if (!free_frames_.empty()) {
+          frame = free_frames_.back();
+          free_frames_.pop_back();
+          return frame;
+        }
+        if (fd_ < 0) {
+          return std::nullopt;
+        }
+        frame = PickVictim();
+        if (frame != kNoSlot) {
+          victim = frames_[frame].slot;
+          slots_[victim].tier = Tier::kSpilling;
+          break;
+        }
+      }
+      // Every frame is in transit; each is released or resident again once
+      // its I/O completes.
+      std::this_thread::yield();
+    }
+
+    // The victim is in transit, so neither its frame nor its slot changes.
+    const bool written = WriteAll(frames_[frame].storage, Offset(victim));
+
+    rwlock::UniqueLock l(rwlock_);
+    if (!written) {
+      slots_[victim].tier = Tier::kResident;
+      return std::nullopt;
+    }
+    slots_[victim].tier = Tier::kSpilled;
+    frames_[frame].slot = kNoSlot;
+    return frame;
+  }
+
+  // Advances the clock hand to the first resident object not accessed since
+  // the hand last passed it, skipping frames in transit. Returns its frame,
+  // or kNoSlot (exclusive lock held).
+  uint32_t PickVictim() {
+    // Two full sweeps find a victim if one is resident: the first clears
+    // every bit.
+    for (size_t step = 0; step < 2 * resident_capacity_; ++step) {
+      const uint32_t frame = clock_hand_;
+      clock_hand_ = (clock_hand_ + 1) % resident_capacity_;
+      if (frames_[frame].slot == kNoSlot) {
+        continue;
+      }
+      Slot &slot = slots_[frames_[frame].slot];
+      if (slot.tier != Tier::kResident ||
+          slot.referenced.exchange(false, std::memory_order_relaxed)) {
+        continue;
+      }
+      return frame;
+    }
+    return kNoSlot;
+  }
+
+  // Returns a frame to the free list (exclusive lock held).
+  void ReleaseFrame(const uint32_t frame) {
+    frames_[frame].slot = kNoSlot;
+    free_frames_.push_back(frame);
+  }
+
+  static off_t Offset(const uint32_t index) {
+    return static_cast<off_t>(index) * static_cast<off_t>(sizeof(T));
+  }
+
+  bool WriteAll(const unsigned char *data, off_t offset) {
+    size_t done = 0;
+    while (done < sizeof(T)) {
+      const ssize_t n = ::pwrite(fd_, data + done, sizeof(T) - done,
+                                 offset + static_cast<off_t>(done));
+      if (n <= 0) {
+        return false;
+      }
+      done += static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  bool ReadAll(unsigned char *data, off_t offset) {
+    size_t done = 0;
+    while (done < sizeof(T)) {
+      const ssize_t n = ::pread(fd_, data + done, sizeof(T) - done,
+                                offset + static_cast<off_t>(done));
+      if (n <= 0) {
+        return false;
+      }
+      done += static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  // Checks validity without locking (callers must hold a lock).
+  bool IsValidInternal(const Handle &handle) const {
+    if (handle.index >= capacity_ || handle == Handle::Invalid()) {
+      return false;
+    }
+    const Slot &slot = slots_[handle.index];
+    return slot.in_use && (slot.generation == handle.generation);
+  }
+
+  const size_t capacity_{0};
+  const size_t resident_capacity_{0};
+  const std::string spill_path_;
+  int fd_{-1};
+
+  std::vector<Slot> slots_;
+  std::vector<Frame> frames_;
+  std::vector<uint32_t> free_list_;
+  std::vector<uint32_t> free_frames_;
+  uint32_t clock_hand_{0};
+
+  // Prefetches waiting for the prefetch thread.
+  std::deque<std::packaged_task<bool()>> prefetch_queue_;
+  bool stopping_{false};
+  std::thread prefetcher_;
+  // Protects prefetch_queue_, stopping_ and prefetcher_.
+  std::mutex prefetch_mutex_;
+  std::condition_variable prefetch_ready_;
+
+  // Protect all shared data (slots_, frames_ and the free lists), except the
+  // bytes of frames in transit.
+  rwlock::RWLock rwlock_;
+};
+
+} // namespace handle_pool
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <utility>
+
+#include "handle_pool/handle_pool.h"
+
+namespace handle_pool {
+
+// A mutable view of a pooled object's trailing bytes.
+struct ByteSpan {
+  std::byte *data;
+  size_t size;
+
+  std::byte *begin() const { return data; }
+  std::byte *end() const { return data + size; }
+  std::byte &operator[](const size_t i) const { return data[i]; }
+};
+
+/*
+ * A pool of T where every object also owns a trailing byte array of up to
+ * `MaxTrailing` bytes, stored in its slot rather than in a separate heap
+ * buffer.
+ *
+ * Objects are kept in size-class sub-pools (64, 128, 256, ... bytes of
+ * trailing storage, the last class being `MaxTrailing`), so a small payload
+ * does not pay for the maximum. The size class is encoded in the top
+ * `kClassBits` bits of the handle index.
+ *
+ * Thread-safety: as for HandlePool; each size class has its own lock.
+ */
+template <typename T, size_t MaxTrailing> class TrailingHandlePool {
+  static constexpr size_t kMinClassBytes = 64;
+
+  static constexpr size_t CountClasses() {
+    size_t count = 1;
+    for (size_t bytes = kMinClassBytes; bytes < MaxTrailing; bytes *= 2) {
+      ++count;
+    }
+    return count;
+  }
+
+public:
+  static constexpr uint32_t kClassBits = 4;
+  static constexpr size_t kClassCount = CountClasses();
+  static_assert(MaxTrailing > 0, "use HandlePool<T> without a payload");
+  static_assert(kClassCount <= (size_t{1} << kClassBits) - 1,
+                "MaxTrailing needs more size classes than handles can encode");
+
+  // Each size class gets `capacity_per_class` slots.
+  explicit TrailingHandlePool(const size_t capacity_per_class)
+      : TrailingHandlePool(capacity_per_class,
+                           std::make_index_sequence<kClassCount>{}) {}
+
+  // Creates a T with a `trailing_bytes` long, zero-filled trailing array,
+  // returning a handle; Handle::Invalid() if `trailing_bytes` exceeds
+  // MaxTrailing or its size class is full.
+  template <typename... Args>
+  const Handle CreateWithTrailing(const size_t trailing_bytes,
+                                  Args &&...args) {
+    if (trailing_bytes > MaxTrailing) {
+      return Handle::Invalid();
+    }
+    const uint32_t cls = ClassFor(trailing_bytes);
+    return Visit(cls, [&](auto &pool) {
+      const Handle handle =
+          pool.Create(trailing_bytes, std::forward<Args>(args)...);
+      if (handle == Handle::Invalid()) {
+        return handle;
+      }
+      return Handle{(cls << kIndexBits) | handle.index, handle.generation};
+    });
+  }
+
+  // Creates a T without trailing bytes.
+  template <typename... Args> const Handle Create(Args &&...args) {
+    return CreateWithTrailing(0, std::forward<Args>(args)...);
+  }
+
+  // Destroy the T and its trailing bytes.
+  bool Destroy(const Handle &handle) {
+    if (!HasValidClass(handle)) {
+      return false;
+    }
+    return Visit(ClassOf(handle), [&](auto &pool) {
+      return pool.Destroy(Local(handle));
+    });
+  }
+
+  // Returns an optional reference to T if the handle is valid, else nullopt.
+  std::optional<std::reference_wrapper<T>> Get(const Handle &handle) {
+    if (!HasValidClass(handle)) {
+      return std::nullopt;
+    }
+    return Visit(ClassOf(handle),
+                 [&](auto &pool) -> std::optional<std::reference_wrapper<T>> {
+                   auto slot = pool.Get(Local(handle));
+                   if (!slot.has_value()) {
+                     return std::nullopt;
+                   }
+                   return std::ref(slot.value().get().value);
+                 });
+  }
+
+  // Returns the object's trailing bytes if the handle is valid, else nullopt.
+  std::optional<ByteSpan> Trailing(const Handle &handle) {
+    if (!HasValidClass(handle)) {
+      return std::nullopt;
+    }
+    return Visit(ClassOf(handle), [&](auto &pool) -> std::optional<ByteSpan> {
+      auto slot = pool.Get(Local(handle));
+      if (!slot.has_value()) {
+        return std::nullopt;
+      }
+      auto &s = slot.value().get();
+      return ByteSpan{s.bytes, s.size};
+    });
+  }
+
+  // Checks if a given handle is still valid.
+  bool IsValid(const Handle &handle) {
+    if (!HasValidClass(handle)) {
+      return false;
+    }
+    return Visit(ClassOf(handle),
+                 [&](auto &pool) { return pool.IsValid(Local(handle)); });
+  }
+
+  // Trailing bytes reserved per slot in size class `cls`.
+  static constexpr size_t ClassBytes(const size_t cls) {
+    const size_t bytes = kMinClassBytes << cls;
+    return bytes < MaxTrailing ? bytes : MaxTrailing;
+  }
+
+  // Slots per size class.
+  inline constexpr size_t CapacityPerClass() const {
+    return capacity_per_class_;
+  }
+
+  // Returns true if no size class holds an object.
+  bool Empty() {
+    bool empty = true;
+    for (uint32_t cls = 0; cls < kClassCount; ++cls) {
+      empty &= Visit(cls, [](auto &pool) { return pool.Empty(); });
+    }
+    return empty;
+  }
+
+  // Returns how many free slots remain in the size class for `trailing_bytes`.
+  size_t Free(const size_t trailing_bytes) {
+    if (trailing_bytes > MaxTrailing) {
+      return 0;
+    }
+    return Visit(ClassFor(trailing_bytes),
+                 [](auto &pool) { return pool.Free(); });
+  }
+
+private:
+  static constexpr uint32_t kIndexBits = 32 - kClassBits;
+
+  template <size_t Bytes> struct Slot {
+    template <typename... Args>
+    explicit Slot(const size_t size, Args &&...args)
+        : size(size), value(std::forward<Args>(args)...) {
+      std::memset(bytes, 0, size);
+    }
+
+    size_t size;
+    T value;
+    alignas(std::max_align_t) std::byte bytes[Bytes];
+  };
+
+  template <size_t... I>
+  TrailingHandlePool(const size_t capacity_per_class,
+                     std::index_sequence<I...>)
+      : capacity_per_class_(capacity_per_class),
+        pools_(std::make_unique<HandlePool<Slot<ClassBytes(I)>>>(
+            capacity_per_class)...) {
+    assert(capacity_per_class_ < (size_t{1} << kIndexBits));
+  }
+
+  static uint32_t ClassFor(const size_t trailing_bytes) {
+    uint32_t cls = 0;
+    while (ClassBytes(cls) < trailing_bytes) {
+      ++cls;
+    }
+    return cls;
+  }
+
+  static uint32_t ClassOf(const Handle &handle) {
+    return handle.index >> kIndexBits;
+  }
+
+  static bool HasValidClass(const Handle &handle) {
+    return ClassOf(handle) < kClassCount;
+  }
+
+  // The handle as seen by its size-class sub-pool.
+  static Handle Local(const Handle &handle) {
+    return Handle{handle.index & ((uint32_t{1} << kIndexBits) - 1),
+                  handle.generation};
+  }
+
+  // Calls fn(HandlePool<Slot<...>> &) for size class `cls`.
+  template <typename Fn> auto Visit(const uint32_t cls, Fn &&fn) {
+    return VisitFrom<0>(cls, fn);
+  }
+
+  template <size_t I, typename Fn> auto VisitFrom(const uint32_t cls, Fn &fn) {
+    if constexpr (I + 1 == kClassCount) {
+      return fn(*std::get<I>(pools_));
+    } else {
+      if (cls == I) {
+        return fn(*std::get<I>(pools_));
+      }
+      return VisitFrom<I + 1>(cls, fn);
+    }
+  }
+
+  template <typename Seq> struct PoolsFor;
+  template <size_t... I> struct PoolsFor<std::index_sequence<I...>> {
+    using type =
+        std::tuple<std::unique_ptr<HandlePool<Slot<ClassBytes(I)>>>...>;
+  };
+
+  const size_t capacity_per_class_;
+  typename PoolsFor<std::make_index_sequence<kClassCount>>::type pools_;
+};
+
+} // namespace handle_pool
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "handle_pool/handle_pool.h"
+#include "rwlock/rw_lock.h"
+#include "rwlock/shared_lock.h"
+#include "rwlock/unique_lock.h"
+
+namespace handle_pool {
+
+/*
+ * A pool for read-mostly objects where readers never take a lock and never
+ * block on writers.
+ *
+ * Every slot holds one atomic indirection word packing the slot's generation
+ * and the version that currently holds its object. `Update(handle, fn)`
+ * copies the current version into a spare version, applies `fn` to the copy
+ * and publishes it with a single store, so readers see either the old or the
+ * new object, never a partially updated one. Replaced versions are retired
+ * and reclaimed once every reader that could still see them has finished
+ * (epoch-based reclamation).
+ *
+ * The pool holds `capacity + spare_versions` versions; an `Update` or
+ * `Create` fails while every spare version is waiting to be reclaimed.
+ *
+ * Thread-safety:
+ * - `Create`, `Destroy`, `Update` and `Reclaim` serialize on an exclusive
+ * lock.
+ * - `Read`, `Load` and `IsValid` are lock-free. `fn` passed to `Read` may
+ * call writer methods, but the object it sees stays the version it read.
+ */
+template <typename T> class VersionedHandlePool {
+  static_assert(std::is_copy_constructible_v<T>,
+                "Update() copies the current version; T must be "
+                "copy-constructible");
+
+public:
+  // Maximum number of concurrent readers; further readers wait for a slot.
+  static constexpr size_t kMaxReaders = 64;
+
+  explicit VersionedHandlePool(const size_t capacity)
+      : VersionedHandlePool(capacity, capacity) {}
+
+  VersionedHandlePool(const size_t capacity, const size_t spare_versions)
+      : capacity_(capacity), version_count_(capacity + spare_versions) {
+    assert(capacity_ > 0);
+    assert(version_count_ < kNoVersion);
+    slots_.reset(new std::atomic<uint64_t>[capacity_]);
+    versions_.reset(new Version[version_count_]);
+    free_list_.reserve(capacity_);
+    for (uint32_t i = 0; i < capacity_; ++i) {
+      slots_[i].store(Pack(0, kNoVersion), std::memory_order_relaxed);
+      free_list_.push_back(i);
+    }
+    free_versions_.reserve(version_count_);
+    for (uint32_t v = 0; v < version_count_; ++v) {
+      free_versions_.push_back(v);
+    }
+    retired_.reserve(version_count_);
+  }
+
+  // Destructor cleans up live and retired versions. No reader may be active.
+  ~VersionedHandlePool() {
+    rwlock::UniqueLock ul(rwlock_);
+    for (size_t i = 0; i < capacity_; ++i) {
+      const uint32_t version = VersionOf(slots_[i].load());
+      if (version != kNoVersion) {
+        Object(version)->~T();
+      }
+    }
+    for (const Retired &retired : retired_) {
+      Object(retired.version)->~T();
+    }
+  }
+
+  // Creates a new T, returning a handle.
+  template <typename... Args> const Handle Create(Args &&...args) {
+    rwlock::UniqueLock l(rwlock_);
+
+    if (free_list_.empty()) {
+      return Handle::Invalid();
+    }
+    const std::optional<uint32_t> version = AcquireVersion();
+    if (!version.has_value()) {
+      return Handle::Invalid();
+    }
+    try {
+      new (&versions_[*version].storage) T(std::forward<Args>(args)...);
+    } catch (...) {
+      free_versions_.push_back(*version);
+      return Handle::Invalid();
+    }
+
+    const uint32_t slot = free_list_.back();
+    free_list_.pop_back();
+    const uint32_t generation = GenerationOf(slots_[slot].load());
+    slots_[slot].store(Pack(generation, *version), std::memory_order_seq_cst);
+    return Handle{slot, generation};
+  }
+
+  // Destroy the T associated with the handle once no reader can see it.
+  bool Destroy(const Handle &handle) {
+    rwlock::UniqueLock l(rwlock_);
+
+    if (!IsValid(handle)) {
+      return false;
+    }
+    const uint32_t version = VersionOf(slots_[handle.index].load());
+    slots_[handle.index].store(Pack(handle.generation + 1, kNoVersion),
+                               std::memory_order_seq_cst);
+    Retire(version);
+    free_list_.push_back(handle.index);
+    return true;
+  }
+
+  // Publishes a copy of the object with fn(T &) applied to it. Returns false
+  // if the handle is stale, no spare version is available, or fn throws.
+  template <typename Fn> bool Update(const Handle &handle, Fn &&fn) {
+    rwlock::UniqueLock l(rwlock_);
+
+    if (!IsValid(handle)) {
+      return false;
+    }
+    const uint32_t current = VersionOf(slots_[handle.index].load());
+    const std::optional<uint32_t> next = AcquireVersion();
+    if (!next.has_value()) {
+      return false;
+    }
+    T *copy = new (&versions_[*next].storage) T(*Object(current));
+    try {
+      fn(*copy);
+    } catch (...) {
+      copy->~T();
+      free_versions_.push_back(*next);
+      return false;
+    }
+    slots_[handle.index].store(Pack(handle.generation, *next),
+                               std::memory_order_seq_cst);
+    Retire(current);
+    return true;
+  }
+
+  // Calls fn(const T &) on the current version without taking a lock.
+  // Returns false if the handle is stale.
+  template <typename Fn> bool Read(const Handle &handle, Fn &&fn) const {
+    ReadGuard guard(*this);
+    if (handle.index >= capacity_) {
+      return false;
+    }
+    const uint64_t word = slots_[handle.index].load(std::memory_order_seq_cst);
+    if (GenerationOf(word) != handle.generation ||
+        VersionOf(word) == kNoVersion) {
+      return false;
+    }
+    fn(*Object(VersionOf(word)));
+    return true;
+  }
+
+  // Returns a copy of the current version if valid, else nullopt.
+  std::optional<T> Load(const Handle &handle) const {
+    std::optional<T> result;
+    Read(handle, [&](const T &obj) { result.emplace(obj); });
+    return result;
+  }
+
+  // Checks if a given handle is still valid, without taking a lock.
+  bool IsValid(const Handle &handle) const {
+    if (handle.index >= capacity_) {
+      return false;
+    }
+    const uint64_t word = slots_[handle.index].load(std::memory_order_acquire);
+    return GenerationOf(word) == handle.generation &&
+           VersionOf(word) != kNoVersion;
+  }
+
+  // Destroys retired versions that no active reader can still see. Returns
+  // how many were reclaimed.
+  size_t Reclaim() {
+    rwlock::UniqueLock l(rwlock_);
+    return ReclaimInternal();
+  }
+
+  inline constexpr size_t Capacity() const { return capacity_; }
+
+  // Returns true if there are no currently used slots.
+  bool Empty() {
+    rwlock::UniqueLock l(rwlock_);
+    return (free_list_.size() == capacity_);
+  }
+
+  // Returns how many free slots remain.
+  size_t Free() {
+    rwlock::UniqueLock l(rwlock_);
+    return free_list_.size();
+  }
+
+  // Disallow copy (owning resource).
+  VersionedHandlePool(const VersionedHandlePool &) = delete;
+  VersionedHandlePool &operator=(const VersionedHandlePool &) = delete;
+
+private:
+  static constexpr uint32_t kNoVersion = std::numeric_limits<uint32_t>::max();
+  // Reader epoch value of an idle reader record.
+  static constexpr uint64_t kIdle = 0;
+
+  struct Version {
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  struct Retired {
+    uint32_t version;
+    // Global epoch at retirement; readers that entered later cannot see it.
+    uint64_t epoch;
+  };
+
+  // One per concurrent reader, each on its own cache line.
+  struct alignas(64) ReaderRecord {
+    std::atomic<uint64_t> epoch{kIdle};
+  };
+
+  // Publishes the current epoch in a free reader record for its lifetime.
+  class ReadGuard {
+  public:
+    explicit ReadGuard(const VersionedHandlePool &pool) {
+      const size_t start =
+          std::hash<std::thread::id>{}(std::this_thread::get_id());
+      for (size_t i = 0;; ++i) {
+        ReaderRecord &record = pool.readers_[(start + i) % kMaxReaders];
+        uint64_t expected = kIdle;
+        if (record.epoch.compare_exchange_strong(
+                expected, pool.epoch_.load(std::memory_order_seq_cst),
+                std::memory_order_seq_cst)) {
+          record_ = &record;
+          return;
+        }
+        if ((i + 1) % kMaxReaders == 0) {
+          std::this_thread::yield();
+        }
+      }
+    }
+    ~ReadGuard() { record_->epoch.store(kIdle, std::memory_order_release); }
+
+    ReadGuard(const ReadGuard &) = delete;
+    ReadGuard &operator=(const ReadGuard &) = delete;
+
+  private:
+    ReaderRecord *record_;
+  };
+
+  static uint64_t Pack(const uint32_t generation, const uint32_t version) {
+    return (static_cast<uint64_t>(generation) << 32) | version;
+  }
+  static uint32_t GenerationOf(const uint64_t word) {
+    return static_cast<uint32_t>(word >> 32);
+  }
+  static uint32_t VersionOf(const uint64_t word) {
+    return static_cast<uint32_t>(word);
+  }
+
+  T *Object(const uint32_t version) const {
+    return reinterpret_cast<T *>(&versions_[version].storage);
+  }
+
+  // Returns a free version, reclaiming retired ones if needed (exclusive
+  // lock held).
+  std::optional<uint32_t> AcquireVersion() {
+    if (free_versions_.empty() && ReclaimInternal() == 0) {
+      return std::nullopt;
+    }
+    const uint32_t version = free_versions_.back();
+    free_versions_.pop_back();
+    return version;
+  }
+
+  // Tags an unpublished version with the current epoch and advances the
+  // epoch (exclusive lock held).
+  void Retire(const uint32_t version) {
+    retired_.push_back(
+        Retired{version, epoch_.fetch_add(1, std::memory_order_seq_cst)});
+  }
+
+  // Exclusive lock held.
+  size_t ReclaimInternal() {
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+    for (const ReaderRecord &reader : readers_) {
+      const uint64_t epoch = reader.epoch.load(std::memory_order_seq_cst);
+      if (epoch != kIdle && epoch < oldest) {
+        oldest = epoch;
+      }
+    }
+    // Readers release their record with a release store.
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    size_t reclaimed = 0;
+    size_t kept = 0;
+    for (const Retired &retired : retired_) {
+      if (retired.epoch < oldest) {
+        Object(retired.version)->~T();
+        free_versions_.push_back(retired.version);
+        ++reclaimed;
+      } else {
+        retired_[kept++] = retired;
+      }
+    }
+    retired_.resize(kept);
+    return reclaimed;
+  }
+
+  const size_t capacity_{0};
+  const size_t version_count_{0};
+
+  // Per slot: generation (high 32 bits) and current version (low 32 bits).
+  std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+  std::unique_ptr<Version[]> versions_;
+
+  // Starts at 1 so that kIdle never names a real epoch.
+  std::atomic<uint64_t> epoch_{1};
+  mutable ReaderRecord readers_[kMaxReaders];
+
+  std::vector<uint32_t> free_list_;
+  std::vector<uint32_t> free_versions_;
+  std::vector<Retired> retired_;
+
+  // Serializes writers (free lists, retired_ and version construction).
+  rwlock::RWLock rwlock_;
+};
+
+} // namespace handle_pool